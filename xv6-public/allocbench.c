@@ -0,0 +1,64 @@
+// Parallel page allocator benchmark.
+//
+// usage: allocbench [workers [rounds]]
+//
+// Each worker repeatedly grows its heap, touches every new
+// page (sbrk() only maps pages on first touch), shrinks it
+// again and forks a child that exits at once, so that every
+// cpu keeps calling kalloc() and kfree(). Prints the ticks
+// the whole run took.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PAGES 16
+
+void
+worker(int rounds)
+{
+  int i, j, pid;
+  char *p;
+
+  for(i = 0; i < rounds; i++){
+    if((p = sbrk(PAGES*4096)) == (char*)-1){
+      printf(2, "allocbench: sbrk failed\n");
+      exit();
+    }
+    for(j = 0; j < PAGES; j++)
+      p[j*4096] = 1;
+    sbrk(-PAGES*4096);
+    pid = fork();
+    if(pid < 0){
+      printf(2, "allocbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int workers = 4, rounds = 200;
+  int i, start;
+
+  if(argc > 1)
+    workers = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+
+  start = uptime();
+  for(i = 0; i < workers; i++){
+    if(fork() == 0)
+      worker(rounds);
+  }
+  for(i = 0; i < workers; i++)
+    wait();
+  printf(1, "allocbench: %d workers x %d rounds in %d ticks\n",
+         workers, rounds, uptime()-start);
+  exit();
+}
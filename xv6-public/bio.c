@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,41 +17,118 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into nbucket chains,
+// each with its own lock, so lookups of different blocks do
+// not contend. binit() sizes the table with the cache, about
+// BCACHELOAD buffers per chain. Buffers nobody holds (refcnt == 0) are also
+// on an LRU list, under lrulock, from which misses recycle.
+// Misses are serialized by bcache.lock, so only one thread
+// at a time moves buffers between chains.
+//
+// Lock order: bcache.lock, then a bucket lock, then lrulock.
+// No thread holds two bucket locks.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;            // Chain through hnext
+};
 
-  // Linked list of all buffers, through prev/next.
+struct {
+  struct spinlock lock;        // Serializes misses
+  struct bucket *bucket;       // nbucket of them, a power of 2
+  int nbucket;
+  int nbuf;
+
+  // Unreferenced buffers, through prev/next.
   // head.next is most recently used.
+  struct spinlock lrulock;
   struct buf head;
 } bcache;
 
+static struct bucket*
+bucketof(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) & (bcache.nbucket - 1)];
+}
+
+// Put b at the head of the LRU list. Caller holds lrulock.
+static void
+lru_push(struct buf *b)
+{
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+}
+
+static void
+lru_remove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Size the cache from the memory left after the kernel
+// has set up, but never below NBUF. Must be called after
+// kinit2().
 void
 binit(void)
 {
   struct buf *b;
+  char *page;
+  int i, n, per, order;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.lrulock, "bcache.lru");
 
 //PAGEBREAK!
-  // Create linked list of buffers
+  // Create the LRU list of buffers, carved out of whole pages.
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  per = PGSIZE / sizeof(struct buf);
+  n = kfreemem() / BCACHEFRAC * per;
+  if(n < NBUF)
+    n = NBUF;
+  while(bcache.nbuf < n){
+    if((page = kalloc()) == 0)
+      break;
+    for(b = (struct buf*)page; b < (struct buf*)page + per; b++){
+      memset(b, 0, sizeof(*b));
+      initsleeplock(&b->lock, "buffer");
+      lru_push(b);
+      bcache.nbuf++;
+    }
+  }
+  if(bcache.nbuf < NBUF)
+    panic("binit");
+
+  // One contiguous hash table for all the buffers, smaller
+  // if memory is too fragmented for that.
+  n = 1;
+  while(n * BCACHELOAD < bcache.nbuf)
+    n *= 2;
+  for(order = 0; order < MAXORDER && (PGSIZE << order) < n * sizeof(struct bucket); order++)
+    ;
+  while((page = kallocpages(order)) == 0)
+    if(order-- == 0)
+      panic("binit: hash table");
+  while(n * sizeof(struct bucket) > (PGSIZE << order))
+    n /= 2;
+  bcache.bucket = (struct bucket*)page;
+  bcache.nbucket = n;
+  for(i = 0; i < n; i++){
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+    bcache.bucket[i].head = 0;
   }
 }
 
@@ -61,35 +138,85 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
-
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(dev, blockno), *old;
+  struct buf *b, **pp;
+  int miss = 0;
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  acquire(&bk->lock);
+  for(;;){
+    // Is the block already cached?
+    for(b = bk->head; b != 0; b = b->hnext){
+      if(b->dev == dev && b->blockno == blockno){
+        if(b->refcnt++ == 0){
+          acquire(&bcache.lrulock);
+          lru_remove(b);
+          release(&bcache.lrulock);
+        }
+        release(&bk->lock);
+        if(miss)
+          release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
+    if(miss)
+      break;
+
+    // Take the miss lock and look again: another miss
+    // may have brought the block in meanwhile.
+    release(&bk->lock);
+    acquire(&bcache.lock);
+    miss = 1;
+    acquire(&bk->lock);
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
+  // Not cached; recycle the least recently used buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // A hit can take a candidate back before its chain is
+  // locked, so check it again under that lock.
+  for(;;){
+    acquire(&bcache.lrulock);
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev)
+      if((b->flags & B_DIRTY) == 0)
+        break;
+    release(&bcache.lrulock);
+    if(b == &bcache.head)
+      panic("bget: no buffers");
+
+    old = b->flags & B_HASHED ? bucketof(b->dev, b->blockno) : 0;
+    if(old)
+      acquire(&old->lock);
+    acquire(&bcache.lrulock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      lru_remove(b);
+      release(&bcache.lrulock);
+      break;
     }
+    release(&bcache.lrulock);
+    if(old)
+      release(&old->lock);
+  }
+  if(old){
+    for(pp = &old->head; *pp != b; pp = &(*pp)->hnext)
+      ;
+    *pp = b->hnext;
+    release(&old->lock);
   }
-  panic("bget: no buffers");
+
+  // Nobody else can see b now.
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = B_HASHED;
+  b->refcnt = 1;
+  acquire(&bk->lock);
+  b->hnext = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +232,45 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Write the contents of n locked bufs to disk together,
+// so the disk driver can sort and merge them.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+    bs[i]->flags |= B_DIRTY;
+  }
+  iderwv(bs, n);
+}
+
+// Start reading the n indicated blocks into the cache and
+// return without waiting for them. They are all queued
+// before the disk starts, so that it can merge them. A
+// later bread() of a block waits for the transfer if it is
+// still in flight.
+void
+breada(uint dev, uint *blocknos, int n)
+{
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < n; i++){
+    b = bget(dev, blocknos[i]);
+    if(b->flags & (B_VALID|B_DIRTY|B_ASYNC)){
+      brelse(b);
+      continue;
+    }
+    // Hands b's lock back now and its reference once the
+    // data is in, or at once if a read is already pending.
+    idereada(b);
+  }
+  idekick();
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -124,20 +290,27 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bunpin(b);
+}
 
-  acquire(&bcache.lock);
+// Drop a reference to b without holding its lock, as
+// ideintr() does when a read-ahead completes.
+void
+bunpin(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bucketof(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    acquire(&bcache.lrulock);
+    lru_push(b);
+    release(&bcache.lrulock);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 //PAGEBREAK!
 // Blank page.
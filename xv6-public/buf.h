@@ -6,9 +6,12 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // hash chain
   struct buf *qnext; // disk queue
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_HASHED 0x8 // buffer is on a hash chain
+#define B_ASYNC 0x10 // read-ahead in flight, see breada()
 
@@ -2,9 +2,13 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct logstat;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct schedevent;
+struct schedstat;
+struct mlfqparam;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -15,6 +19,9 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            breada(uint, uint*, int);
+void            bunpin(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -57,6 +64,9 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
+void            idereada(struct buf*);
+void            idekick(void);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -66,8 +76,16 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kallocpages(int);
+int             kfreemem(void);
+void            kfreepages(char*, int);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kzalloc(void);
+int             kzerofill(void);
+void            kref(char*);
+int             krefcount(char*);
+void            ksplitpages(char*, int);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +96,8 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
+void            lapictimer(int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -85,7 +105,10 @@ void            microdelay(int);
 void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+int             logcap(void);
+void            getlogstat(struct logstat*);
 
 // mp.c
 extern int      ismp;
@@ -112,6 +135,7 @@ struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+void            kproc(char*, void (*)(void));
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -121,13 +145,11 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 int             cpu_share(int);
-void            pop_list(struct proc* ,int);
-void            push_list(struct proc*,int);
 void            init_mlfq(void);
 void            init_stride(void);
-void            init_list(void);
-double          return_stride(void);
 int             getlev(void);
+int             getschedstat(int, struct schedstat*);
+int             setmlfq(struct mlfqparam*, struct mlfqparam*);
 int             run_MLFQ(void);
 void            print_mlfq(void);
 
@@ -169,6 +191,11 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// trace.c
+void            traceinit(void);
+void            tracesched(struct proc*, uint64);
+int             traceread(struct schedevent*, int);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
@@ -195,6 +222,9 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             cowfault(pde_t*, uint);
+int             lazyfault(pde_t*, uint, uint);
+int             uvmprefault(pde_t*, uint, uint, uint, int);
 //prac_syscall.c
 int		my_syscall(char*);
 int		getppid(void);
@@ -117,27 +117,31 @@ fileread(struct file *f, char *addr, int n)
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
+  int r, nb;
 
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write up to half the log at a time, leaving room
+    // for another writer, and reserve only what the chunk
+    // can dirty: its data blocks (one more if not aligned),
+    // the i-node, 3 index blocks (a chunk is shorter than an
+    // indirect block, so it touches at most two of those
+    // and the double-indirect or first indirect block), and
+    // a bitmap block per allocation, data or index, at worst.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = (logcap()/2 - 1 - NBITMAP - 4) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      nb = (f->off % BSIZE + n1 + BSIZE-1) / BSIZE;
+      begin_opn(nb + 4 + (nb+3 < NBITMAP ? nb+3 : NBITMAP));
       ilock(f->ip);
       if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -16,13 +16,19 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ra_next;       // block a sequential reader asks for next
+  uint ra_win;        // read-ahead window in blocks, 0 if off
+  uint ra_end;        // first block not yet read ahead
+  uint ext_bn;        // file blocks ext_bn.. are known to be
+  uint ext_addr;      //   at disk blocks ext_addr..,
+  uint ext_len;       //   ext_len of them, see bmap()
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // table mapping major device number to
@@ -22,6 +22,8 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define RAMIN 4   // blocks read ahead once a reader is sequential
+#define RAMAX 16  // largest read-ahead window
 static void itrunc(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
@@ -52,17 +54,23 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, the first free one
+// from goal on, wrapping around at the end of the disk.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int b, bi, i, m;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal >= sb.size)
+    goal = 0;
+  b = goal - goal % BPB;
+  bi = goal % BPB;
+  // Visit goal's bitmap block again last for the
+  // bits before goal.
+  for(i = 0; i <= (sb.size + BPB-1) / BPB; i++){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
@@ -73,6 +81,10 @@ balloc(uint dev)
       }
     }
     brelse(bp);
+    bi = 0;
+    b += BPB;
+    if(b >= sb.size)
+      b = 0;
   }
   panic("balloc: out of blocks");
 }
@@ -267,6 +279,10 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ra_next = 0;
+  ip->ra_win = 0;
+  ip->ra_end = 0;
+  ip->ext_len = 0;
   release(&icache.lock);
 
   return ip;
@@ -368,38 +384,110 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
+// Look up entry i of indirect block addr, which maps file
+// block bn of ip, allocating the block at goal or after it
+// if necessary. Remembers the run of contiguous blocks that
+// starts there in ip->ext, or extends the run ip->ext has if
+// the two meet.
+static uint
+bmapind(struct inode *ip, uint addr, uint i, uint bn, uint goal)
+{
+  uint *a, j;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = balloc(ip->dev, goal);
+    log_write(bp);
+  }
+  for(j = i+1; j < NINDIRECT && a[j] == addr + (j-i); j++)
+    ;
+  brelse(bp);
+
+  if(bn == ip->ext_bn + ip->ext_len && addr == ip->ext_addr + ip->ext_len){
+    ip->ext_len += j - i;
+  } else {
+    ip->ext_bn = bn;
+    ip->ext_addr = addr;
+    ip->ext_len = j - i;
+  }
+  return addr;
+}
+
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, right after
+// the file's previous block if that is free, so that files
+// are laid out in contiguous runs. Blocks in ip->ext's run
+// need no index block reads, so sequential access reads each
+// index block once per run rather than once per block.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, goal, fbn;
   struct buf *bp;
 
+  if(bn - ip->ext_bn < ip->ext_len)
+    return ip->ext_addr + (bn - ip->ext_bn);
+
+  goal = 0;
+  if(bn > 0 && bn <= NDIRECT)
+    goal = ip->addrs[bn-1] + 1;
+  else if(bn - 1 - ip->ext_bn < ip->ext_len)
+    goal = ip->ext_addr + (bn - ip->ext_bn);
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, goal);
     return addr;
   }
+  fbn = bn;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, goal);
+    return bmapind(ip, addr, bn, fbn, goal);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect
+    // block bn is in, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev, goal);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn/NINDIRECT]) == 0){
+      a[bn/NINDIRECT] = addr = balloc(ip->dev, goal);
       log_write(bp);
     }
     brelse(bp);
-    return addr;
+    return bmapind(ip, addr, bn%NINDIRECT, fbn, goal);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists.
+static void
+bfreeind(uint dev, uint addr)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -420,17 +508,23 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip->dev, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        bfreeind(ip->dev, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
+  ip->ext_len = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -447,6 +541,38 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Called by readi() after it has read block bn of ip.
+// While the reader goes block after block, keep the next
+// ip->ra_win blocks in flight, doubling the window on each
+// new block up to RAMAX. A seek turns read-ahead off until
+// the reader is sequential again.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, last, blocknos[RAMAX];
+  int n;
+
+  if(bn == ip->ra_next){
+    ip->ra_win = ip->ra_win ? min(2*ip->ra_win, RAMAX) : RAMIN;
+  } else if(bn+1 != ip->ra_next){
+    // A seek; rereading the last block is not one.
+    ip->ra_win = 0;
+    ip->ra_end = 0;
+  }
+  ip->ra_next = bn+1;
+  if(ip->ra_win == 0)
+    return;
+
+  last = min(bn + ip->ra_win, (ip->size + BSIZE-1) / BSIZE - 1);
+  b = ip->ra_end > bn+1 ? ip->ra_end : bn+1;
+  for(n = 0; b <= last; b++)
+    blocknos[n++] = bmap(ip, b);
+  breada(ip->dev, blocknos, n);
+  if(last+1 > ip->ra_end)
+    ip->ra_end = last+1;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -472,6 +598,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
+    readahead(ip, off/BSIZE);
   }
   return n;
 }
@@ -23,6 +23,9 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMULT 0xc6
+
+#define MAXMULT       8   // most sectors moved by one command
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -32,7 +35,10 @@ static struct spinlock idelock;
 static struct buf *idequeue;
 
 static int havedisk1;
+static int idemult = 1;    // sectors per READ/WRITE MULTIPLE
+static int idebatch;       // queued bufs in the active command
 static void idestart(struct buf*);
+static void idego(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +53,17 @@ idewait(int checkerr)
   return 0;
 }
 
+// Set the multiple-mode block size of disk to MAXMULT.
+// Returns -1 if the disk refuses.
+static int
+idesetmult(int disk)
+{
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f2, MAXMULT);
+  outb(0x1f7, IDE_CMD_SETMULT);
+  return idewait(1);
+}
+
 void
 ideinit(void)
 {
@@ -65,35 +82,59 @@ ideinit(void)
     }
   }
 
+  // Move up to MAXMULT sectors per interrupt if every
+  // disk supports it.
+  if(idesetmult(0) == 0 && (!havedisk1 || idesetmult(1) == 0))
+    idemult = MAXMULT;
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b, merged with the requests queued
+// right behind it for the next blocks of the same disk in the
+// same direction, up to idemult sectors in one command.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *q;
+  int n;
+
   if(b == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  if (sector_per_block > 1 && sector_per_block > idemult) panic("idestart");
+
+  n = 1;
+  for(q = b->qnext; q != 0; q = q->qnext){
+    if((n+1) * sector_per_block > idemult || q->dev != b->dev ||
+       q->blockno != b->blockno + n || q->blockno >= FSSIZE ||
+       (q->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    n++;
+  }
+  idebatch = n;
+
+  int nsect = n * sector_per_block;
+  int read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(q = b; n > 0; n--, q = q->qnext)
+      outsl(0x1f0, q->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,66 +144,173 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *async[MAXMULT];
+  int i, n, nasync, reading, ok;
 
-  // First queued buffer is the active request.
+  // The first idebatch queued buffers are the active request.
   acquire(&idelock);
 
   if((b = idequeue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  // Read data if needed; the whole batch is ready at once.
+  reading = !(b->flags & B_DIRTY);
+  ok = reading && idewait(1) >= 0;
+
+  nasync = 0;
+  n = idebatch;
+  for(i = 0; i < n; i++){
+    b = idequeue;
+    idequeue = b->qnext;
+    if(ok)
+      insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.
+    if(b->flags & B_ASYNC)
+      async[nasync++] = b;
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_ASYNC);
+    wakeup(b);
+  }
+  idebatch = 0;
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
     idestart(idequeue);
 
   release(&idelock);
+
+  // Drop the references read-aheads left behind.
+  for(i = 0; i < nasync; i++)
+    bunpin(async[i]);
+}
+
+// Add b to idequeue in C-LOOK order: ascending block numbers
+// from the request in progress, wrapping around once, so
+// that the disk sweeps one way and adjacent blocks end up
+// next to each other for idestart() to merge. The caller
+// starts the disk if it was idle, after queueing all it has,
+// and must hold idelock.
+static void
+idequeue_add(struct buf *b)
+{
+  struct buf **pp;
+  uint cur;
+  int i;
+
+  b->qnext = 0;
+  if(idequeue == 0){
+    idequeue = b;
+    return;
+  }
+
+  // Leave the requests the disk is working on in front.
+  pp = &idequeue;
+  for(i = 0; i < idebatch; i++)
+    pp = &(*pp)->qnext;
+  cur = idequeue->blockno;
+  while(*pp != 0 && (*pp)->blockno - cur <= b->blockno - cur)  //DOC:insert-queue
+    pp = &(*pp)->qnext;
+  b->qnext = *pp;
+  *pp = b;
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Sync bufs with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// All n requests are queued before waiting, so that they can
+// be sorted and merged.
 void
-iderw(struct buf *b)
+iderwv(struct buf **bs, int n)
 {
-  struct buf **pp;
+  struct buf *b;
+  int i;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  for(i = 0; i < n; i++){
+    b = bs[i];
+    if(!holdingsleep(&b->lock))
+      panic("iderw: buf not locked");
+    if(b->dev != 0 && !havedisk1)
+      panic("iderw: ide disk 1 not present");
+  }
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
-
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  // ideintr() may have just finished a read-ahead of b,
+  // or one may still be queued; then there is nothing to
+  // queue and waiting is enough. The flags are only
+  // stable under idelock. Queue them all before starting
+  // an idle disk, so that the first can merge too.
+  for(i = 0; i < n; i++){
+    b = bs[i];
+    if((b->flags & B_ASYNC) || (b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      continue;
+    idequeue_add(b);
+  }
+  idego();
 
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+  // Wait for requests to finish.
+  for(i = 0; i < n; i++){
+    while((bs[i]->flags & (B_VALID|B_DIRTY)) != B_VALID){
+      sleep(bs[i], &idelock);
+    }
   }
 
+  release(&idelock);
+}
 
+void
+iderw(struct buf *b)
+{
+  iderwv(&b, 1);
+}
+
+// Start the disk on the queue if it is idle. Caller must
+// hold idelock.
+static void
+idego(void)
+{
+  if(idebatch == 0 && idequeue != 0)
+    idestart(idequeue);
+}
+
+// Start the reads queued by idereada().
+void
+idekick(void)
+{
+  acquire(&idelock);
+  idego();
+  release(&idelock);
+}
+
+// Queue a read of b without waiting for it; idekick()
+// starts it, so that a run of read-aheads can be queued
+// and merged first. The caller's lock on b is released
+// here; the reference it holds is dropped by ideintr()
+// when the data is in, or here if b is valid, dirty or
+// already being read.
+void
+idereada(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("idereada: buf not locked");
+  if(b->dev != 0 && !havedisk1)
+    panic("idereada: ide disk 1 not present");
+
+  acquire(&idelock);
+  if(b->flags & (B_VALID|B_DIRTY|B_ASYNC)){
+    // Not under idelock: brelse() takes cache locks
+    // that ideintr() takes after dropping it.
+    release(&idelock);
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  idequeue_add(b);
+  // Before ideintr() can drop the reference.
+  releasesleep(&b->lock);
   release(&idelock);
 }
@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and runs of
+// 2^order pages with kallocpages().
 
 #include "types.h"
 #include "defs.h"
@@ -10,19 +11,61 @@
 #include "spinlock.h"
 
 void freerange(void *vstart, void *vend);
+static void kpagestest(void);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run {
   struct run *next;
+  struct run *prev;            // only on the buddy lists
 };
 
+// Free memory is kept by a buddy allocator: a free block of
+// order k is 2^k pages, aligned to its size in physical
+// memory, and its buddy is the block whose address differs
+// in bit PGSHIFT+k. Freeing a block merges it with its buddy
+// for as long as the buddy is free too. MAXORDER is in
+// param.h.
+#define BFREE    0x80          // in border[]: heads a free block
+
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1]; // Free blocks by order
+  uint nfree;                   // Free pages on free[]
+  struct run *zero;             // Pages zeroed by kzerofill()
+  int nzero;
 } kmem;
 
+// BFREE|order for the first page of each free block, else 0.
+static uchar border[PHYSTOP/PGSIZE];
+#define BORDER(v) border[V2P(v)/PGSIZE]
+
+// Per-cpu magazine of free pages. Only its own cpu touches
+// it, with interrupts off, so it needs no lock. It refills
+// from and drains to the buddy lists KBATCH pages at a time.
+// Pages held here are not visible to other cpus, so at most
+// NCPU*KMAG pages can be stranded when memory runs out.
+#define KMAG   32
+#define KBATCH 16
+
+// Idle cpus zero up to KZERO pages ahead of time for
+// kzalloc() on any cpu; see kzerofill(). The pool is shared,
+// under kmem.lock, because the cpus that allocate are the
+// busy ones and the cpus that fill it are the idle ones.
+#define KZERO  64
+
+struct kcache {
+  struct run *list;
+  int n;
+} kcache[NCPU];
+
+// Number of page tables mapping each allocated physical page;
+// copy-on-write fork shares pages between parent and child.
+// Updated with atomic instructions. Free pages have 0.
+static ushort refcnt[PHYSTOP/PGSIZE];
+#define REF(v) refcnt[V2P(v)/PGSIZE]
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -40,6 +83,10 @@ void
 kinit2(void *vstart, void *vend)
 {
   freerange(vstart, vend);
+  kpagestest();
+  // kzerofill() on other cpus reads use_lock without the
+  // lock; the free lists must be complete before it is set.
+  __sync_synchronize();
   kmem.use_lock = 1;
 }
 
@@ -51,6 +98,179 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+// Buddy list operations. Caller holds kmem.lock.
+static void
+buddy_push(struct run *r, int k)
+{
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  BORDER(r) = BFREE | k;
+}
+
+static void
+buddy_remove(struct run *r, int k)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  BORDER(r) = 0;
+}
+
+// Take a block of order k, splitting a larger one if
+// need be. Returns 0 if there is none.
+static struct run*
+buddy_alloc(int k)
+{
+  struct run *r;
+  int j;
+
+  for(j = k; j <= MAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > MAXORDER)
+    return 0;
+  r = kmem.free[j];
+  buddy_remove(r, j);
+  // Give back the upper halves.
+  while(j > k){
+    j--;
+    buddy_push((struct run*)((char*)r + (PGSIZE << j)), j);
+  }
+  kmem.nfree -= 1 << k;
+  return r;
+}
+
+// Return the block of order k at v, merging it with
+// free buddies.
+static void
+buddy_free(char *v, int k)
+{
+  uint pa = V2P(v), buddy;
+
+  kmem.nfree += 1 << k;
+  for(; k < MAXORDER; k++){
+    buddy = pa ^ (PGSIZE << k);
+    if(buddy >= PHYSTOP || border[buddy/PGSIZE] != (BFREE | k))
+      break;
+    buddy_remove((struct run*)P2V(buddy), k);
+    pa &= ~(PGSIZE << k);
+  }
+  buddy_push((struct run*)P2V(pa), k);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if the memory cannot be
+// allocated. Use kalloc() for single pages.
+char*
+kallocpages(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kallocpages");
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  r = buddy_alloc(order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return (char*)r;
+}
+
+// Number of free blocks of order k.
+static int
+buddy_count(int k)
+{
+  struct run *r;
+  int n;
+
+  n = 0;
+  for(r = kmem.free[k]; r; r = r->next)
+    n++;
+  return n;
+}
+
+// Boot-time check of kallocpages() and kfreepages(): take two
+// blocks of every order, which splits larger blocks, then free
+// them and make sure the buddies merged back into the same
+// free lists. Runs from kinit2() before any other cpu can
+// allocate, so nothing else moves the counts.
+static void
+kpagestest(void)
+{
+  int k, j, before[MAXORDER+1];
+  uint nfree;
+  char *a[MAXORDER+1], *b[MAXORDER+1];
+
+  nfree = kmem.nfree;
+  for(k = 0; k <= MAXORDER; k++)
+    before[k] = buddy_count(k);
+  for(k = 0; k <= MAXORDER; k++){
+    a[k] = kallocpages(k);
+    b[k] = kallocpages(k);
+    if(a[k] == 0 || b[k] == 0 || a[k] == b[k] ||
+       V2P(a[k]) % (PGSIZE << k) || V2P(b[k]) % (PGSIZE << k))
+      panic("kpagestest: alloc");
+    for(j = 0; j < k; j++)
+      if(a[j] < a[k] + (PGSIZE << k) && a[k] < a[j] + (PGSIZE << j))
+        panic("kpagestest: overlap");
+  }
+  if(kmem.nfree != nfree - 2 * ((2 << MAXORDER) - 1))
+    panic("kpagestest: nfree");
+  for(k = MAXORDER; k >= 0; k--){
+    kfreepages(b[k], k);
+    kfreepages(a[k], k);
+  }
+  if(kmem.nfree != nfree)
+    panic("kpagestest: nfree");
+  for(k = 0; k <= MAXORDER; k++)
+    if(buddy_count(k) != before[k])
+      panic("kpagestest: coalesce");
+}
+
+// Hand out the 2^order pages of a block from kallocpages(order)
+// as single pages, each with one reference, so that kfree()
+// and kref() work on them one at a time.
+void
+ksplitpages(char *v, int order)
+{
+  int i;
+
+  for(i = 0; i < (1 << order); i++)
+    REF(v + i*PGSIZE) = 1;
+}
+
+// Number of free pages, not counting per-cpu magazines.
+int
+kfreemem(void)
+{
+  return kmem.nfree;
+}
+
+// Free 2^order pages returned by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) >= PHYSTOP)
+    panic("kfreepages");
+
+#ifdef KDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddy_free(v, order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -59,21 +279,47 @@ freerange(void *vstart, void *vend)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *t;
+  int i;
+  struct kcache *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // Only the last reference frees the page. Pages handed
+  // over by freerange() start with none.
+  if(REF(v) > 0 && __sync_sub_and_fetch(&REF(v), 1) > 0)
+    return;
+
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    // Still booting: no other cpus, and cpuid() may not work.
+    buddy_free(v, 0);
+    return;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  if(c->n >= KMAG){
+    // Drain a batch to the buddy lists.
+    acquire(&kmem.lock);
+    for(i = 0; i < KBATCH; i++){
+      t = c->list;
+      c->list = t->next;
+      buddy_free((char*)t, 0);
+    }
     release(&kmem.lock);
+    c->n -= KBATCH;
+  }
+  r->next = c->list;
+  c->list = r;
+  c->n++;
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +329,114 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
 
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    if((r = buddy_alloc(0)) != 0)
+      REF(r) = 1;
+    return (char*)r;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  if(c->n == 0){
+    // Refill a batch from the buddy lists.
     acquire(&kmem.lock);
-  r = kmem.freelist;
+    while(c->n < KBATCH && (r = buddy_alloc(0)) != 0){
+      r->next = c->list;
+      c->list = r;
+      c->n++;
+    }
+    release(&kmem.lock);
+  }
+  r = c->list;
+  if(r){
+    c->list = r->next;
+    c->n--;
+  } else {
+    // Out of dirty pages; a zeroed one will do.
+    acquire(&kmem.lock);
+    if((r = kmem.zero) != 0){
+      kmem.zero = r->next;
+      kmem.nzero--;
+    }
+    release(&kmem.lock);
+  }
+  popcli();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+    REF(r) = 1;
+  return (char*)r;
+}
+
+// Add a reference to an allocated page.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP || REF(v) == 0)
+    panic("kref");
+  __sync_fetch_and_add(&REF(v), 1);
+}
+
+int
+krefcount(char *v)
+{
+  return REF(v);
+}
+
+// Allocate one zeroed page, preferably one zeroed ahead
+// of time by kzerofill(). Returns 0 if out of memory.
+char*
+kzalloc(void)
+{
+  struct run *r = 0;
+
+  // The pool is empty until the scheduler runs.
+  if(kmem.use_lock && kmem.nzero > 0){
+    acquire(&kmem.lock);
+    if((r = kmem.zero) != 0){
+      kmem.zero = r->next;
+      kmem.nzero--;
+    }
     release(&kmem.lock);
+  }
+  if(r){
+    r->next = 0;
+    return (char*)r;
+  }
+
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
+// Zero one page for the shared pool. Called by the
+// scheduler when it has nothing to run. Returns 1 if a page
+// was added, 0 if the pool is full or memory is short, or
+// before kinit2() has finished: the other cpus go idle while
+// the allocator is still being filled without its lock.
+int
+kzerofill(void)
+{
+  struct run *r;
+
+  // Unlocked peeks; a stale answer costs one page's work.
+  if(!kmem.use_lock || kmem.nzero >= KZERO || kmem.nfree == 0)
+    return 0;
+
+  if((r = (struct run*)kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  if(kmem.nzero >= KZERO){
+    release(&kmem.lock);
+    kfree((char*)r);
+    return 0;
+  }
+  r->next = kmem.zero;
+  kmem.zero = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
+
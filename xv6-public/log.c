@@ -5,6 +5,9 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "mmu.h"
+#include "proc.h"
+#include "logstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -19,6 +22,15 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_opn() reserves as much log space as the caller
+// says it needs, begin_op() MAXOPBLOCKS.
+//
+// Group commit: the last end_op() leaves the transaction
+// open for later system calls to join, and to absorb more
+// writes of the same blocks, unless it is LOGDELAY ticks
+// old, nearly full or holding up a begin_op(). The
+// committer process commits transactions left open once
+// they are LOGDELAY ticks old.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -29,6 +41,10 @@
 //   ...
 // Log appends are synchronous.
 
+#define LOGBATCH 8  // log blocks handed to the disk at once
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
@@ -40,20 +56,27 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // blocks a transaction can hold
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they reserved
   int committing;  // in commit(), please wait.
+  int wanted;      // begin_op()s waiting for log space
+  uint opened;     // ticks when the transaction logged its first block
+  int nops;        // FS sys calls in the transaction
   int dev;
   struct logheader lh;
+  struct logstat stat;
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void committer(void);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
@@ -61,23 +84,39 @@ initlog(int dev)
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  log.cap = min(LOGSIZE, log.size - 1);
+  log.stat.nlog = log.cap;
   log.dev = dev;
   recover_from_log();
+  kproc("committer", committer);
+}
+
+// Blocks a transaction can hold; begin_opn() must not
+// ask for more.
+int
+logcap(void)
+{
+  return log.cap;
 }
 
 // Copy committed blocks from log to their home location
 static void
 install_trans(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  int tail, i, n;
+  struct buf *lbuf, *dbuf[LOGBATCH];
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = min(log.lh.n - tail, LOGBATCH);
+    for (i = 0; i < n; i++) {
+      lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwritev(dbuf, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
   }
 }
 
@@ -121,55 +160,119 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Commit the open transaction. Called with log.lock held
+// and no FS system calls outstanding; returns with it held.
+static void
+groupcommit(void)
+{
+  log.committing = 1;
+  if(log.lh.n > 0){
+    log.stat.ncommit++;
+    log.stat.nops += log.nops;
+    log.stat.nlogged += log.lh.n;
+  }
+  log.nops = 0;
+  release(&log.lock);
+
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  commit();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+}
+
+// called at the start of each FS system call that may
+// write up to n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log.cap)
+    panic("begin_op: too big");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+    } else if(log.lh.n + log.reserved + n > log.cap){
+      // this op might exhaust log space; commit first.
+      if(log.outstanding == 0){
+        groupcommit();
+      } else {
+        log.wanted++;
+        sleep(&log, &log.lock);
+        log.wanted--;
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and the transaction should not stay open.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
+  log.nops++;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && log.lh.n > 0){
+    if(log.wanted > 0 || ticks - log.opened >= LOGDELAY ||
+       log.lh.n + MAXOPBLOCKS > log.cap)
+      groupcommit();
+    else
+      wakeup(&log.lh);  // start the committer's clock
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+// The committer process. Commits a transaction that
+// end_op() left open once it is LOGDELAY ticks old.
+static void
+committer(void)
+{
+  uint due;
+
+  acquire(&log.lock);
+  for(;;){
+    if(log.lh.n == 0 || log.outstanding > 0 || log.committing){
+      sleep(&log.lh, &log.lock);
+      continue;
+    }
+    if(ticks - log.opened >= LOGDELAY){
+      groupcommit();
+      continue;
+    }
+    due = log.opened + LOGDELAY;
     release(&log.lock);
+
+    acquire(&tickslock);
+    while((int)(ticks - due) < 0)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
   }
 }
 
@@ -177,15 +280,20 @@ end_op(void)
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  int tail, i, n;
+  struct buf *to[LOGBATCH], *from;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = min(log.lh.n - tail, LOGBATCH);
+    for (i = 0; i < n; i++) {
+      to[i] = bread(log.dev, log.start+tail+i+1); // log block
+      from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwritev(to, n);  // write the log, sequential on disk
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
@@ -215,20 +323,35 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
+  log.stat.nwrite++;
   for (i = 0; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    if (log.lh.n == 0)
+      log.opened = ticks;
     log.lh.n++;
+  } else {
+    log.stat.nabsorb++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
 
+// Copy the log statistics into st.
+void
+getlogstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  release(&log.lock);
+}
+
@@ -0,0 +1,89 @@
+// Write-ahead log statistics.
+//
+// usage: logstat [writers [kbytes]]
+//
+// With no arguments prints the log statistics since boot.
+// Otherwise each writer creates its own file and writes
+// kbytes to it, small writes at a time; then prints the
+// ticks that took and what the log saw meanwhile.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "logstat.h"
+
+#define CHUNK 512
+
+void
+show(struct logstat *st)
+{
+  printf(1, "commits %d ops %d (%d per commit)\n", st->ncommit, st->nops,
+         st->ncommit ? st->nops / st->ncommit : 0);
+  printf(1, "writes %d absorbed %d logged %d capacity %d\n",
+         st->nwrite, st->nabsorb, st->nlogged, st->nlog);
+}
+
+void
+writer(int id, int kbytes)
+{
+  static char buf[CHUNK];
+  char name[] = "logstat.0";
+  int fd, i;
+
+  name[8] = '0' + id % 10;
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+    printf(2, "logstat: cannot create %s\n", name);
+    exit();
+  }
+  memset(buf, 'a' + id % 26, sizeof(buf));
+  for(i = 0; i < kbytes * 1024 / CHUNK; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(2, "logstat: write failed\n");
+      break;
+    }
+  }
+  close(fd);
+  unlink(name);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct logstat before, after;
+  int i, writers, kbytes;
+  uint start;
+
+  if(argc < 2){
+    getlogstat(&after);
+    show(&after);
+    exit();
+  }
+
+  writers = atoi(argv[1]);
+  kbytes = argc > 2 ? atoi(argv[2]) : 32;
+  if(writers < 1 || kbytes < 1){
+    printf(2, "usage: logstat [writers [kbytes]]\n");
+    exit();
+  }
+
+  getlogstat(&before);
+  start = uptime();
+  for(i = 0; i < writers; i++){
+    if(fork() == 0)
+      writer(i, kbytes);
+  }
+  for(i = 0; i < writers; i++)
+    wait();
+  getlogstat(&after);
+
+  printf(1, "%d writers x %d KB: %d ticks\n", writers, kbytes, uptime() - start);
+  after.ncommit -= before.ncommit;
+  after.nops -= before.nops;
+  after.nwrite -= before.nwrite;
+  after.nabsorb -= before.nabsorb;
+  after.nlogged -= before.nlogged;
+  show(&after);
+  exit();
+}
@@ -0,0 +1,9 @@
+// Write-ahead log statistics, see getlogstat().
+struct logstat {
+  uint ncommit;   // Transactions committed
+  uint nops;      // FS operations they grouped
+  uint nwrite;    // log_write() calls
+  uint nabsorb;   // log_write()s of blocks already in the transaction
+  uint nlogged;   // Blocks written to the log
+  uint nlog;      // Blocks a transaction can hold
+};
@@ -28,14 +28,14 @@ main(void)
   uartinit();      // serial port
   init_mlfq();
   init_stride();
-  init_list();
   pinit();         // process table
+  traceinit();     // scheduler trace
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized from free memory
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -58,3 +58,25 @@ iderw(struct buf *b)
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
 }
+
+// The memory disk has no latency to hide: read now.
+void
+idereada(struct buf *b)
+{
+  iderw(b);
+  brelse(b);
+}
+
+void
+idekick(void)
+{
+}
+
+void
+iderwv(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bs[i]);
+}
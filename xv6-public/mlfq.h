@@ -0,0 +1,16 @@
+// MLFQ tuning tables, see setmlfq(). Levels are numbered
+// as getlev() reports them, 0 being the highest priority.
+struct mlfqparam {
+  int nlevel;                   // Levels in use, 1..MLFQ_MAXLEV
+  int quantum[MLFQ_MAXLEV];     // Ticks per quantum at each level
+  int allot[MLFQ_MAXLEV];       // Ticks before moving down a level;
+                                // the last level has none
+  int boost;                    // MLFQ ticks between priority boosts
+};
+
+// Upper bounds setmlfq() accepts. A quantum is programmed
+// into the lapic timer as quantum*TICK, which must fit in
+// 32 bits.
+#define MLFQ_MAXQUANTUM 100
+#define MLFQ_MAXALLOT   10000
+#define MLFQ_MAXBOOST   10000
@@ -0,0 +1,76 @@
+// Show or replace the MLFQ tables.
+//
+// usage: mlfqctl [boost q0:a0 q1:a1 ... qN]
+//
+// With no arguments prints the tables in force. Otherwise
+// installs one level per quantum argument; every level but
+// the last takes an allotment after the colon. Only this
+// program, installed as /mlfqctl, may replace the tables.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "mlfq.h"
+
+void
+show(struct mlfqparam *m)
+{
+  int i;
+
+  printf(1, "levels %d boost %d\n", m->nlevel, m->boost);
+  for(i = 0; i < m->nlevel; i++){
+    if(i < m->nlevel-1)
+      printf(1, "  level %d: quantum %d allot %d\n", i, m->quantum[i], m->allot[i]);
+    else
+      printf(1, "  level %d: quantum %d\n", i, m->quantum[i]);
+  }
+}
+
+void
+usage(void)
+{
+  printf(2, "usage: mlfqctl [boost q0:a0 q1:a1 ... qN]\n");
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct mlfqparam new, old;
+  char *s;
+  int i;
+
+  if(argc == 1){
+    if(setmlfq(0, &old) < 0){
+      printf(2, "mlfqctl: cannot read tables\n");
+      exit();
+    }
+    show(&old);
+    exit();
+  }
+  if(argc < 3 || argc-2 > MLFQ_MAXLEV)
+    usage();
+
+  memset(&new, 0, sizeof(new));
+  new.boost = atoi(argv[1]);
+  new.nlevel = argc-2;
+  for(i = 0; i < new.nlevel; i++){
+    new.quantum[i] = atoi(argv[i+2]);
+    s = strchr(argv[i+2], ':');
+    if(s != 0)
+      new.allot[i] = atoi(s+1);
+    else if(i < new.nlevel-1)
+      usage();
+  }
+
+  if(setmlfq(&new, &old) < 0){
+    printf(2, "mlfqctl: bad tables, or not run as /mlfqctl\n");
+    exit();
+  }
+  printf(1, "was: ");
+  show(&old);
+  printf(1, "now: ");
+  show(&new);
+  exit();
+}
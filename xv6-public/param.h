@@ -7,8 +7,13 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  10  // max # of blocks an FS op writes, see begin_opn()
+#define LOGSIZE      127  // max data blocks in on-disk log (fills the header block)
+#define LOGDELAY     100  // ticks a transaction may wait for more ops
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEFRAC   64  // give 1/BCACHEFRAC of free memory to the cache
+#define BCACHELOAD    2  // buffers per buffer cache hash chain
+#define MAXORDER     10  // largest kallocpages() block is 2^MAXORDER pages
+#define FSSIZE       20000  // size of file system in blocks
+#define MLFQ_MAXLEV   8  // maximum number of MLFQ levels
 
@@ -4,17 +4,64 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "schedstat.h"
+#include "mlfq.h"
+
+#define NPIDHASH 64
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
 
 struct {
   struct spinlock lock;
+  struct spinlock proclock[NPROC];
   struct proc proc[NPROC];
+  struct proc *free;           // UNUSED slots
+  struct proc *pidhash[NPIDHASH]; // Slots with a pid, by pid
+  int share_total;             // Sum of live SHARE percentages
 } ptable;
 
-struct MLFQ_struct mlfq_s;
-struct STRIDE_struct stride_s;
-struct proc_list proc_l[NPROC];
+// Per-CPU run queue. It holds only RUNNABLE processes;
+// a process is taken off its queue when it is picked to
+// run and is put back when it becomes RUNNABLE again.
+struct runq {
+  struct spinlock lock;
+  struct MLFQ_struct mlfq_s;
+  struct STRIDE_struct stride_s;
+  struct proc *share[NPROC];   // SHARE processes, min-heap on pass
+  int share_num;
+  int nrun;                    // Number of queued processes
+  int nclass[3];               // Queued processes per schedstate
+  int share_total;             // Sum of queued SHARE percentages
+  uint64 min_pass;
+  struct mlfqparam param;      // Copy of mlfq, refreshed by choice()
+  int param_gen;
+} runq[NCPU];
+
+// MLFQ tables in force. setmlfq() replaces them as a whole
+// under mlfqlock and bumps mlfq_gen; each run queue picks up
+// the new copy the next time it schedules.
+static struct spinlock mlfqlock;
+static struct mlfqparam mlfq = {
+  3, {1, 2, 4}, {5, 10}, 100
+};
+static int mlfq_gen;
+
+// The controller program, which alone besides init may
+// replace the MLFQ tables.
+#define MLFQCTL "/mlfqctl"
+
+// Sleeping processes, hashed by channel so that wakeup()
+// only looks at processes that may be waiting on it.
+#define NWAITQ 64
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
 
 static struct proc *initproc;
 
@@ -23,13 +70,125 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
-
-double min_pass = 0;
+static void mlfq_charge(struct proc*);
+static void rq_enqueue(struct proc *p);
+static int leastloaded(void);
+static void kick(int);
+static void push_list(struct runq*, struct proc*, int, int);
+static void pop_list(struct runq*, struct proc*, int);
+static void splice_list(struct runq*, int, int);
+static uint return_stride(struct runq*);
+static void freeproc(struct proc*);
 
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NPROC; i++)
+    initlock(&ptable.proclock[i], "proc");
+  for(i = NPROC-1; i >= 0; i--){
+    ptable.proc[i].hnext = ptable.free;
+    ptable.free = &ptable.proc[i];
+  }
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  initlock(&mlfqlock, "mlfq");
+  for(i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+}
+
+// The lock protecting p->state and the switch
+// between p and the scheduler.
+static struct spinlock*
+plock(struct proc *p)
+{
+  return &ptable.proclock[p - ptable.proc];
+}
+
+// Find the process with the given pid, or 0.
+// Caller holds ptable.lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[PIDHASH(pid)]; p != 0; p = p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Unhash p and put its slot back on the free list.
+// Caller holds ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp != p; pp = &(*pp)->hnext)
+    ;
+  *pp = p->hnext;
+  p->pid = 0;
+  p->state = UNUSED;
+  p->hnext = ptable.free;
+  ptable.free = p;
+}
+
+// The wait queue of chan. Its lock protects the links
+// and p->chan of every process on it.
+static struct waitq*
+waitqof(void *chan)
+{
+  return &waitq[((uint)chan >> 2) % NWAITQ];
+}
+
+// Sibling lists: each process is on its parent's children
+// list while alive and on its zombies list once it exits.
+// Caller holds ptable.lock.
+static void
+sibling_push(struct proc **head, struct proc *p)
+{
+  p->sprev = 0;
+  p->snext = *head;
+  if(*head)
+    (*head)->sprev = p;
+  *head = p;
+}
+
+static void
+sibling_remove(struct proc **head, struct proc *p)
+{
+  if(p->sprev)
+    p->sprev->snext = p->snext;
+  else
+    *head = p->snext;
+  if(p->snext)
+    p->snext->sprev = p->sprev;
+}
+
+// Hand every process on *from to initproc's list *to.
+// Returns the number moved.
+static int
+reparent(struct proc **from, struct proc **to)
+{
+  struct proc *p, *last = 0;
+  int n = 0;
+
+  for(p = *from; p != 0; p = p->snext){
+    p->parent = initproc;
+    last = p;
+    n++;
+  }
+  if(last == 0)
+    return 0;
+  last->snext = *to;
+  if(*to)
+    (*to)->sprev = last;
+  *to = *from;
+  *from = 0;
+  return n;
 }
 
 // Must be called with interrupts disabled
@@ -84,25 +243,34 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if((p = ptable.free) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  ptable.free = p->hnext;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
-  p->data.stride.swtch = stride_s.switch_num;
+  p->hnext = ptable.pidhash[PIDHASH(p->pid)];
+  ptable.pidhash[PIDHASH(p->pid)] = p;
+  p->children = 0;
+  p->zombies = 0;
+  p->cpu = leastloaded();
+  p->data.stride.swtch = runq[p->cpu].stride_s.switch_num;
   p->sched_state = DEFAULT;
+  p->run_cycles = 0;
+  p->wait_cycles = 0;
+  p->run_ticks = 0;
+  p->nvcsw = 0;
+  p->nivcsw = 0;
+  memset(p->level_ticks, 0, sizeof(p->level_ticks));
   release(&ptable.lock);
-  
-  if(p->pid == 1)
-      push_list(p,0);
+
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -123,6 +291,28 @@ found:
   return p;
 }
 
+// Start a kernel process running fn, which must never
+// return. Like any new process it begins in forkret(),
+// which then returns into fn instead of trapret.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kproc");
+  *(uint*)(p->context + 1) = (uint)fn;
+  p->sz = 0;
+  p->parent = 0;
+  p->cwd = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(plock(p));
+  p->state = RUNNABLE;
+  rq_enqueue(p);
+  release(plock(p));
+}
+
 //PAGEBREAK: 32
 // Set up first user process.
 void
@@ -153,11 +343,12 @@ userinit(void)
   // run this process. the acquire forces the above
   // writes to be visible, and the lock is also needed
   // because the assignment might not be atomic.
-  acquire(&ptable.lock);
+  acquire(plock(p));
 
   p->state = RUNNABLE;
+  rq_enqueue(p);
 
-  release(&ptable.lock);
+  release(plock(p));
 }
 
 // Grow current process's memory by n bytes.
@@ -170,8 +361,11 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the range; lazyfault() allocates
+    // each page when it is first touched.
+    if(sz + n >= KERNBASE || sz + n < sz)
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -199,12 +393,13 @@ fork(void)
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
 
   np->sz = curproc->sz;
-  np->parent = curproc;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -216,16 +411,22 @@ fork(void)
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  np->exe = curproc->exe;
+  np->bigpages = curproc->bigpages;
 
   pid = np->pid;
 
   acquire(&ptable.lock);
+  np->parent = curproc;
+  sibling_push(&curproc->children, np);
+  release(&ptable.lock);
+
+  acquire(plock(np));
 
   np->state = RUNNABLE;
-  if(np->pid != 1)
-    push_list(np,0);
+  rq_enqueue(np);
 
-  release(&ptable.lock);
+  release(plock(np));
 
   return pid;
 }
@@ -237,7 +438,6 @@ void
 exit(void)
 {
   struct proc *curproc = myproc();
-  struct proc *p;
   int fd;
 
   if(curproc == initproc)
@@ -258,18 +458,28 @@ exit(void)
 
   acquire(&ptable.lock);
   // Parent might be sleeping in wait().
+  sibling_remove(&curproc->parent->children, curproc);
+  sibling_push(&curproc->parent->zombies, curproc);
   wakeup1(curproc->parent);
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
-  }
-  
-  // Jump into the scheduler, never to return.
+  reparent(&curproc->children, &initproc->children);
+  if(reparent(&curproc->zombies, &initproc->zombies) > 0)
+    wakeup1(initproc);
+
+  // Give our cpu share back.
+  if(curproc->sched_state == SHARE)
+    ptable.share_total -= curproc->data.share.share;
+
+  // The parent cannot reap us before we hold our own lock:
+  // wait() needs ptable.lock to find us and our lock to
+  // free us, and the scheduler drops it only after we
+  // have switched away for good.
+  acquire(plock(curproc));
+  mlfq_charge(curproc);
   curproc->state = ZOMBIE;
+  release(&ptable.lock);
+
+  // Jump into the scheduler, never to return.
   sched();
   panic("zombie exit");
 }
@@ -280,35 +490,30 @@ int
 wait(void)
 {
   struct proc *p;
-  int havekids, pid;
+  int pid;
   struct proc *curproc = myproc();
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
-      havekids = 1;
-      if(p->state == ZOMBIE){
-        // Found one.
-        pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
-        release(&ptable.lock);
-        return pid;
-      }
+    // Exited children are queued on curproc->zombies.
+    if((p = curproc->zombies) != 0){
+      sibling_remove(&curproc->zombies, p);
+      // Wait until it has switched away for good.
+      acquire(plock(p));
+      pid = p->pid;
+      kfree(p->kstack);
+      p->kstack = 0;
+      freevm(p->pgdir);
+      p->parent = 0;
+      p->name[0] = 0;
+      p->killed = 0;
+      freeproc(p);
+      release(plock(p));
+      release(&ptable.lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || curproc->killed){
+    if(curproc->children == 0 || curproc->killed){
       release(&ptable.lock);
       return -1;
     }
@@ -327,362 +532,547 @@ getlev(void){
         return -1;
 }
 
+// Queue numbers: 0 is the DEFAULT (stride) list,
+// 1-MLFQ_MAXLEV are the MLFQ levels.
+static struct proc_queue*
+list_header(struct runq *rq, int num){
+    if(num == 0)
+        return &rq->stride_s.list;
+    return &rq->mlfq_s.level[num-1];
+}
+
+static void
+print_list(struct proc_queue *proc_h){
+    struct proc *p;
+
+    for(p = proc_h->start; p != 0; p = p->qnext)
+        cprintf("%d[%d][%d] ",p->pid,p->data.mlfq.level,p->data.mlfq.exec_count);
+}
+
 void
 print_mlfq(void){
-    struct proc_list *pl;
-    cprintf("boost[%d]\nfirst[%d] : ",mlfq_s.boosting_period,mlfq_s.first.proc_num);
-    pl = mlfq_s.first.start;
-    while(pl != 0){
-        cprintf("%d[%d][%d] ",pl->p->pid,pl->p->data.mlfq.level,pl->p->data.mlfq.exec_count);
-        pl = pl->next;
-    }
-    cprintf("\nsecond[%d] : ",mlfq_s.second.proc_num);
-    pl = mlfq_s.second.start;
-    while(pl != 0){
-        cprintf("%d[%d][%d] ",pl->p->pid,pl->p->data.mlfq.level,pl->p->data.mlfq.exec_count);
-        pl = pl->next;
-    }
-    cprintf("\nthird[%d] : ",mlfq_s.third.proc_num);
-    pl = mlfq_s.third.start;
-    while(pl != 0){
-        cprintf("%d[%d][%d] ",pl->p->pid,pl->p->data.mlfq.level,pl->p->data.mlfq.exec_count);
-        pl = pl->next;
+    struct runq *rq;
+
+    int i;
+
+    for(rq = runq; rq < &runq[ncpu]; rq++){
+        cprintf("cpu%d boost[%d/%d]\n",(int)(rq-runq),ticks-rq->mlfq_s.boost_tick,rq->param.boost);
+        for(i = 0; i < rq->param.nlevel; i++){
+            cprintf("level%d[%d] : ",i,rq->mlfq_s.level[i].proc_num);
+            print_list(&rq->mlfq_s.level[i]);
+            cprintf("\n");
+        }
+        cprintf("\n");
     }
-    cprintf("\n\n");
 }
 
+// Move every queued MLFQ process of rq to the first level.
+// The lower levels are spliced on whole, so the cost does not
+// grow with the number of processes; each process resets its
+// own level and allotment in mlfq_catchup() when it is next
+// picked or queued.
 void
-mlfq_boosting(void){
-    struct proc *p = 0;
-    struct proc_list *pl = mlfq_s.first.start;
+mlfq_boosting(struct runq *rq){
+    int i;
 
-    while(pl != 0){
-        pl->p->data.mlfq.exec_count = 0;
-        pl = pl->next;
-    }
-    while(mlfq_s.third.proc_num > 0){
-        p = mlfq_s.third.start->p;
-        pop_list(p, 3);
-        push_list(p, 1);
-        p->data.mlfq.level = 1;
-        p->data.mlfq.exec_count = 0;
-    }
+    for(i = 2; i <= rq->param.nlevel; i++)
+        splice_list(rq, 1, i);
+    rq->mlfq_s.boost_gen++;
+    rq->mlfq_s.boost_tick = ticks;
+}
 
-    while(mlfq_s.second.proc_num > 0){
-        p = mlfq_s.second.start->p;
-        pop_list(p, 2);
-        push_list(p, 1);
-        p->data.mlfq.level = 1;
-        p->data.mlfq.exec_count = 0;
-    }
-    
-    mlfq_s.boosting_period = 0;
+// Apply any boost p missed while it sat on a level queue,
+// was running or was sleeping. Caller holds rq->lock.
+static void
+mlfq_catchup(struct runq *rq, struct proc *p){
+    if(p->data.mlfq.boost == rq->mlfq_s.boost_gen)
+        return;
+    p->data.mlfq.level = 1;
+    p->data.mlfq.exec_count = 0;
+    p->data.mlfq.front = 0;
+    p->data.mlfq.boost = rq->mlfq_s.boost_gen;
 }
 
 struct proc*
-mlfq_start(void){
+mlfq_start(struct runq *rq){
     struct proc *p = 0;
-    struct proc_list *temp = 0;
-    struct proc_header *proc_h = 0;
+    struct proc_queue *proc_h = 0;
 
     int cur_level = 0;
-    int time_quantum[3] = {1,2,4};
-    int time_allot[2] = {5,10};
-    
-
-    if(mlfq_s.first.proc_num > 0){
-        proc_h = &mlfq_s.first;
-        cur_level = 0;
-    }else if(mlfq_s.second.proc_num > 0){
-ltwo:        
-        proc_h = &mlfq_s.second;
-        cur_level = 1;
-        goto out;
-    }else if(mlfq_s.third.proc_num > 0){
-lthree:
-        proc_h = &mlfq_s.third;
-        cur_level = 2;
-        goto out;
-    }
+    int slice = 0;
+    int last = rq->param.nlevel - 1;
+    int *time_quantum = rq->param.quantum;
+    int *time_allot = rq->param.allot;
 
-out:
-    temp = proc_h->start;
-    while(temp != 0){
-        if(temp->p->state == RUNNABLE)
+    for(cur_level = 0; cur_level <= last; cur_level++)
+        if(rq->mlfq_s.level[cur_level].proc_num > 0)
             break;
-        temp = temp->next;
-    }
-
-    if(temp == 0){
-        if(cur_level == 0)
-            goto ltwo;
-        else if(cur_level == 1)
-            goto lthree;
-        else if(cur_level == 2)
-            return 0;
-    }
-    
-    p = temp->p;
-    p->data.mlfq.exec_count++;
-    mlfq_s.pass += 50;
-    mlfq_s.boosting_period++;
+    if(cur_level > last)
+        return 0;
+    proc_h = &rq->mlfq_s.level[cur_level];
+
+    p = proc_h->start;
+    pop_list(rq, p, cur_level+1);
+    mlfq_catchup(rq, p);
+
+    // Run for the rest of the quantum in one go, cut short
+    // by the allotment. mlfq_charge() charges the ticks it
+    // really runs once it stops.
+    // The tables may have shrunk since p was last charged.
+    slice = time_quantum[cur_level] - p->data.mlfq.exec_count % time_quantum[cur_level];
+    if(cur_level < last && slice > time_allot[cur_level] - p->data.mlfq.exec_count)
+        slice = time_allot[cur_level] - p->data.mlfq.exec_count;
+    if(slice < 1)
+        slice = 1;
+    p->slice = slice;
+    p->data.mlfq.given = slice;
+    p->data.mlfq.level = cur_level+1;
     //print_mlfq();
 
-    //time_allotment check
-    if(cur_level <= 1){
-        if(p->data.mlfq.exec_count % time_allot[cur_level] == 0){
-            //move down
-            pop_list(p, cur_level+1);
-            push_list(p, cur_level+2);
-            p->data.mlfq.exec_count = 0;
-            p->data.mlfq.level = cur_level+2;
-            return p;
-        }
-    }
+    return p;
+}
 
-    //time_quantum check
-    if(p->data.mlfq.exec_count % time_quantum[cur_level] == 0){
+// Charge the running MLFQ process p, which is giving up
+// the cpu, for the ticks it ran: at least one, so that
+// yielding often is no cheaper than before, and at most
+// its slice. Then decide where it queues next. Called by
+// yield(), sleep() and exit() with p's lock held.
+static void
+mlfq_charge(struct proc *p){
+    struct runq *rq = &runq[p->cpu];
+    int lev, last, used, ran;
+
+    if(p->sched_state != MLFQ)
+        return;
+
+    ran = ticks - p->tick_in;
+    used = ran;
+    if(used > p->data.mlfq.given)
+        used = p->data.mlfq.given;
+    if(used < 1)
+        used = 1;
+
+    acquire(&rq->lock);
+    last = rq->param.nlevel - 1;
+    lev = p->data.mlfq.level - 1;
+    if(lev > last)
+        lev = last;
+    p->level_ticks[lev] += ran;
+    p->data.mlfq.exec_count += used;
+    rq->mlfq_s.pass += used * (STRIDE1/20);
+
+    if(lev < last && p->data.mlfq.exec_count >= rq->param.allot[lev]){
+        //move down
+        p->data.mlfq.exec_count = 0;
+        p->data.mlfq.level = lev+2;
+        p->data.mlfq.front = 0;
+    } else if(p->data.mlfq.exec_count % rq->param.quantum[lev] == 0){
         //move back
-        pop_list(p, cur_level+1);
-        push_list(p, cur_level+1);
-        if(cur_level == 2)
-            p->data.mlfq.exec_count -= time_quantum[cur_level];
+        p->data.mlfq.front = 0;
+        if(lev == last)
+            p->data.mlfq.exec_count = 0;
+    } else {
+        //keep the head of its level for the rest of the quantum
+        p->data.mlfq.front = 1;
     }
-
-    return p;
+    release(&rq->lock);
 }
 
 struct proc*
-stride_start(void){
+stride_start(struct runq *rq){
+    struct proc *p = rq->stride_s.list.start;
+
+    // The list is FIFO, so once its head has run in this
+    // round every queued DEFAULT process has: start a new one.
+    if(p->data.stride.swtch != rq->stride_s.switch_num){
+        rq->stride_s.switch_num = 1 - rq->stride_s.switch_num;
+        rq->stride_s.pass += rq->stride_s.stride;
+        rq->stride_s.stride = return_stride(rq);
+    }
 
-    struct proc_list* temp;
-    int flap = 0;
+    p->data.stride.swtch = 1 - rq->stride_s.switch_num;
+    pop_list(rq, p, 0);
+    p->slice = 1;
+    return p;
+}
 
-again:
-    flap = 0;
+static uint
+return_stride(struct runq *rq){
+    
+    int share_percent = rq->share_total;
+    int dp_count = rq->nclass[DEFAULT];
+    int mlfq_exist = rq->nclass[MLFQ] > 0 ? 1 : 0;
+    int portion = 0;
 
-    temp = stride_s.list.start;
+    if(dp_count == 0)
+        return 0;
+    portion = ((100-share_percent)-(20*mlfq_exist))/dp_count;
+    if(portion <= 0)
+        portion = 1;
+    return STRIDE1/portion;
+}
 
-runnable:
-    if(temp == 0){
-        flap = 1;
-        goto flp;
-    }
-    while(temp->p->data.stride.swtch != stride_s.switch_num){
-        if(temp->next == 0){
-            flap = 1;
-            goto flp;
+void init_mlfq(void){
+    struct runq *rq;
+    int i;
+
+    for(rq = runq; rq < &runq[NCPU]; rq++){
+        rq->mlfq_s.pass = 0;
+        rq->mlfq_s.boost_tick = 0;
+        rq->mlfq_s.boost_gen = 0;
+        for(i = 0; i < MLFQ_MAXLEV; i++){
+            rq->mlfq_s.level[i].proc_num = 0;
+            rq->mlfq_s.level[i].start = 0;
+            rq->mlfq_s.level[i].end = 0;
         }
-        temp = temp->next;
+        rq->param = mlfq;
+        rq->param_gen = mlfq_gen;
     }
-    if(temp->p->state != RUNNABLE){
-        temp = temp->next;
-        goto runnable;
+}
+
+void init_stride(void){
+    struct runq *rq;
+
+    for(rq = runq; rq < &runq[NCPU]; rq++){
+        rq->stride_s.list.proc_num = 0;
+        rq->stride_s.list.start = 0;
+        rq->stride_s.list.end = 0;
+
+        rq->stride_s.pass = 0;
+        rq->stride_s.stride = STRIDE1/10;
+        rq->stride_s.switch_num = 0;
+
+        rq->share_num = 0;
+        rq->nrun = 0;
+        rq->nclass[DEFAULT] = 0;
+        rq->nclass[SHARE] = 0;
+        rq->nclass[MLFQ] = 0;
+        rq->share_total = 0;
+        rq->min_pass = 0;
     }
+}
 
-flp:
-    if(flap == 1){
-        stride_s.switch_num = 1 - stride_s.switch_num;
-        stride_s.pass += stride_s.stride;
-        stride_s.stride = return_stride();
-        goto again;
+// Link p at the tail (or the head, if front is set) of
+// queue num of rq.
+static void
+push_list(struct runq *rq, struct proc *p, int num, int front){
+    struct proc_queue *proc_h = list_header(rq, num);
+
+    if(proc_h->proc_num == 0){
+        p->qnext = 0;
+        p->qprev = 0;
+        proc_h->start = p;
+        proc_h->end = p;
+    }else if(front){
+        p->qnext = proc_h->start;
+        p->qprev = 0;
+        proc_h->start->qprev = p;
+        proc_h->start = p;
     }else{
-        temp->p->data.stride.swtch = 1 - stride_s.switch_num;
-        return temp->p;
+        p->qnext = 0;
+        p->qprev = proc_h->end;
+        proc_h->end->qnext = p;
+        proc_h->end = p;
     }
 
-    panic("stride_sched error");
+    proc_h->proc_num++;
 }
 
+// Unlink p from queue num of rq.
+static void
+pop_list(struct runq *rq, struct proc *p, int num){
+    struct proc_queue *proc_h = list_header(rq, num);
 
-int mlfq_total_num(void){
-    return mlfq_s.first.proc_num + mlfq_s.second.proc_num + mlfq_s.third.proc_num;
-}
+    if(p->qprev == 0 && proc_h->start != p)
+        panic("no matching process");
 
-double
-return_stride(void){
-    
-    struct proc *p = 0;
-    int share_percent = 0;
-    int dp_count = 0;
-    int mlfq_exist = mlfq_total_num() > 0 ? 1 : 0;
+    if(p->qprev != 0)
+        p->qprev->qnext = p->qnext;
+    else
+        proc_h->start = p->qnext;
+    if(p->qnext != 0)
+        p->qnext->qprev = p->qprev;
+    else
+        proc_h->end = p->qprev;
+    p->qnext = 0;
+    p->qprev = 0;
 
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-            continue;
-        if(p->sched_state == SHARE)
-            share_percent += p->data.share.share;
-        if(p->sched_state == DEFAULT)
-            dp_count++;
-    }
-    if(dp_count == 0)
-        return 0;
-    return 1000/(((100-share_percent)-(20*mlfq_exist))/dp_count);
+    proc_h->proc_num--;
 }
 
-void init_mlfq(void){
-    mlfq_s.pass = 0;
-    mlfq_s.boosting_period = 0;
-    mlfq_s.first.proc_num = 0;
-    mlfq_s.second.proc_num = 0;
-    mlfq_s.third.proc_num = 0;
-
-    for(int i = 0; i < NPROC; i++){
-        mlfq_s.first.start = 0;
-        mlfq_s.first.end = 0;
-        mlfq_s.second.start = 0;
-        mlfq_s.second.end = 0;
-        mlfq_s.third.start = 0;
-        mlfq_s.third.end = 0;
+// Move every process of queue src onto the tail of queue dst.
+static void
+splice_list(struct runq *rq, int dst, int src){
+    struct proc_queue *to = list_header(rq, dst);
+    struct proc_queue *from = list_header(rq, src);
+
+    if(from->proc_num == 0)
+        return;
+    if(to->proc_num == 0){
+        to->start = from->start;
+    }else{
+        to->end->qnext = from->start;
+        from->start->qprev = to->end;
     }
+    to->end = from->end;
+    to->proc_num += from->proc_num;
+
+    from->start = 0;
+    from->end = 0;
+    from->proc_num = 0;
 }
 
-void init_stride(void){
-    
-    stride_s.list.start = 0;
-    stride_s.list.end = 0;
+// Add p to the SHARE heap of rq, keyed on its pass.
+static void
+share_push(struct runq *rq, struct proc *p){
+    int i = rq->share_num++;
+    int parent;
 
-    stride_s.pass = 0;
-    stride_s.stride = 100;
-    stride_s.switch_num = 0;
+    while(i > 0){
+        parent = (i-1)/2;
+        if(!PASS_LT(p->data.share.pass, rq->share[parent]->data.share.pass))
+            break;
+        rq->share[i] = rq->share[parent];
+        i = parent;
+    }
+    rq->share[i] = p;
 }
 
-void push_list(struct proc *p, int num){
+// Remove and return the SHARE process of rq with the lowest pass.
+static struct proc*
+share_pop(struct runq *rq){
+    struct proc *top = rq->share[0];
+    struct proc *last = rq->share[--rq->share_num];
+    int n = rq->share_num;
     int i = 0;
-    struct proc_header *proc_h = 0;
+    int child;
 
-    while(proc_l[i].use != 0)
-        i++;
-    if(i == NPROC)
-        panic("use check error");
+    while((child = 2*i+1) < n){
+        if(child+1 < n && PASS_LT(rq->share[child+1]->data.share.pass, rq->share[child]->data.share.pass))
+            child++;
+        if(!PASS_LT(rq->share[child]->data.share.pass, last->data.share.pass))
+            break;
+        rq->share[i] = rq->share[child];
+        i = child;
+    }
+    if(n > 0)
+        rq->share[i] = last;
+    return top;
+}
 
-    proc_l[i].p = p;
-    proc_l[i].next = 0;
-    proc_l[i].use = 1;
-    
-    if(num == 0)
-        proc_h = &stride_s.list;
-    else if(num == 1)
-        proc_h = &mlfq_s.first;
-    else if(num == 2)
-        proc_h = &mlfq_s.second;
-    else if(num == 3)
-        proc_h = &mlfq_s.third;
-
-        if(proc_h->proc_num == 0){
-            proc_h->start = &proc_l[i];
-            proc_h->end = &proc_l[i];
-        }else{
-            proc_h->end->next = &proc_l[i];
-            proc_h->end = &proc_l[i];
+// Queue a RUNNABLE process on rq. Caller holds rq->lock.
+static void
+enqueue_locked(struct runq *rq, struct proc *p){
+    if(p->sched_state == MLFQ){
+        mlfq_catchup(rq, p);
+        if(p->data.mlfq.level > rq->param.nlevel){
+            // Its level went away with the last setmlfq().
+            p->data.mlfq.level = rq->param.nlevel;
+            p->data.mlfq.exec_count = 0;
+            p->data.mlfq.front = 0;
         }
-
-        proc_h->proc_num++;
+        push_list(rq, p, p->data.mlfq.level, p->data.mlfq.front);
+    }else if(p->sched_state == SHARE)
+        share_push(rq, p);
+    else
+        push_list(rq, p, 0, 0);
+    rq->nrun++;
+    rq->nclass[p->sched_state]++;
+    if(p->sched_state == SHARE)
+        rq->share_total += p->data.share.share;
 }
 
-void pop_list(struct proc *p, int num){
-    struct proc_header *proc_h = 0;
-    struct proc_list *proc_temp = 0;
-
-    if(num == 0)
-        proc_h = &stride_s.list;
-    else if(num == 1)
-        proc_h = &mlfq_s.first;
-    else if(num == 2)
-        proc_h = &mlfq_s.second;
-    else if(num == 3)
-        proc_h = &mlfq_s.third;
-
-    if(proc_h->start->p->pid == p->pid){
-        proc_h->start->use = 0;
-        proc_h->start = proc_h->start->next;
-        if(proc_h->proc_num == 1)
-            proc_h->end = 0;
+// Account for p having been taken off rq. Caller holds rq->lock.
+static void
+dequeued_locked(struct runq *rq, struct proc *p){
+    rq->nrun--;
+    rq->nclass[p->sched_state]--;
+    if(p->sched_state == SHARE)
+        rq->share_total -= p->data.share.share;
+}
 
-    }else{
-        proc_temp = proc_h->start;
-        if(proc_temp->next == 0){
-            cprintf("%d %d \n",proc_temp->p->data.mlfq.level,proc_temp->p->pid);
-            cprintf("num:%d p->pid:%d h->pid%d\n",num,p->pid,proc_h->start->p->pid);
-            print_mlfq();
-            panic("no matching process");
-        }
+// Queue a process that has just become RUNNABLE on the
+// run queue of its cpu. Caller holds the process's lock.
+static void
+rq_enqueue(struct proc *p){
+    struct runq *rq = &runq[p->cpu];
+
+    p->stamp = rdtsc();
+    acquire(&rq->lock);
+    enqueue_locked(rq, p);
+    release(&rq->lock);
+    kick(p->cpu);
+}
 
-        while(proc_temp->next->p->pid != p->pid)
-            proc_temp = proc_temp->next;
-        
-        proc_temp->next->use = 0;
-        if(proc_temp->next->next == 0)
-            proc_h->end = proc_temp;
-        proc_temp->next = proc_temp->next->next;
+// New work was queued on cpu i. Wake it if it is halted in
+// scheduler(); if it is busy, wake an idle cpu instead so
+// that it can steal the work.
+// Must be called with interrupts disabled.
+static void
+kick(int i){
+    struct cpu *c = &cpus[i];
+
+    if(!c->idle){
+        for(c = cpus; c < cpus+ncpu; c++)
+            if(c->idle)
+                break;
+        if(c == cpus+ncpu)
+            return;
     }
+    // An idle cpu taking an interrupt wakes up by itself.
+    if(c != mycpu())
+        lapicipi(c->apicid, T_RESCHED);
+}
 
-    proc_h->proc_num--;
+// Halt this cpu until an interrupt arrives, unless work has
+// been queued on rq. c->idle is published before rq is checked
+// and wakers queue work before they check c->idle, so either
+// we see the work or the waker sees us idle and sends an IPI.
+static void
+idle(struct cpu *c, struct runq *rq){
+    uint64 start;
+
+    cli();
+    xchg(&c->idle, 1);
+    __sync_synchronize();
+    if(rq->nrun == 0){
+        start = rdtsc();
+        stihlt();
+        c->idle_cycles += rdtsc() - start;
+    }
+    xchg(&c->idle, 0);
 }
 
-void init_list(void){
-    int i = 0;
-    for(i = 0; i < NPROC; i++){
-        proc_l[i].p = 0;
-        proc_l[i].next = 0;
-        proc_l[i].use = 0;
+// Run queue with the least work, for a new process.
+static int
+leastloaded(void){
+    int i, load;
+    int best = 0;
+    int best_load = NPROC+1;
+
+    for(i = 0; i < ncpu; i++){
+        load = runq[i].nrun + (cpus[i].proc != 0);
+        if(load < best_load){
+            best = i;
+            best_load = load;
+        }
     }
+    return best;
 }
 
-void clear_list(void){
-    int i = 0;
+// Idle cpu: move one queued process from the busiest
+// other run queue onto rq. Returns 1 if one was moved.
+static int
+steal(struct runq *rq){
+    struct runq *victim = 0;
+    struct runq *r = 0;
+    struct proc *p = 0;
+    int i;
 
-    for(i = 0; i< NPROC; i++){
-        if(proc_l[i].p == 0 || proc_l[i].p->state == SLEEPING || proc_l[i].p->state == RUNNABLE)
-            continue;
+    // Unlocked peek; the victim is rechecked under its lock.
+    for(r = runq; r < &runq[ncpu]; r++)
+        if(r != rq && r->nrun > 0 && (victim == 0 || r->nrun > victim->nrun))
+            victim = r;
+    if(victim == 0)
+        return 0;
+
+    // DEFAULT first, then MLFQ from the lowest level up.
+    acquire(&victim->lock);
+    if(victim->stride_s.list.proc_num > 0){
+        p = victim->stride_s.list.start;
+        pop_list(victim, p, 0);
+    }
+    for(i = MLFQ_MAXLEV; p == 0 && i >= 1; i--){
+        if(list_header(victim, i)->proc_num > 0){
+            p = list_header(victim, i)->start;
+            pop_list(victim, p, i);
+        }
+    }
+    // The last heap slot is a leaf and can simply be dropped.
+    if(p == 0 && victim->share_num > 0)
+        p = victim->share[--victim->share_num];
+    if(p != 0 && p->sched_state == MLFQ)
+        mlfq_catchup(victim, p);
+    if(p != 0)
+        dequeued_locked(victim, p);
+    release(&victim->lock);
+    if(p == 0)
+        return 0;
 
-        if(proc_l[i].p->sched_state == DEFAULT)
-            pop_list(proc_l[i].p, 0);
-        else
-            pop_list(proc_l[i].p, proc_l[i].p->data.mlfq.level);
+    // Nobody else can reach p while it is off both queues.
+    // Its pass and round state only mean something on the
+    // queue it came from, so restart them on this one.
+    acquire(&rq->lock);
+    p->cpu = rq - runq;
+    if(p->sched_state == SHARE)
+        p->data.share.pass = rq->stride_s.pass;
+    else if(p->sched_state == MLFQ)
+        p->data.mlfq.boost = rq->mlfq_s.boost_gen;
+    else
+        p->data.stride.swtch = rq->stride_s.switch_num;
+    enqueue_locked(rq, p);
+    release(&rq->lock);
+    return 1;
+}
 
-        proc_l[i].p = 0;
-        proc_l[i].next = 0;
-        proc_l[i].use = 0;
+// Bring rq's copy of the MLFQ tables up to date. Processes
+// queued on levels that no longer exist drop to the new last
+// level. Caller holds rq->lock.
+static void
+mlfq_refresh(struct runq *rq){
+    struct proc *p = 0;
+    int i, last;
+
+    if(rq->param_gen == mlfq_gen)
+        return;
+    acquire(&mlfqlock);
+    rq->param = mlfq;
+    rq->param_gen = mlfq_gen;
+    release(&mlfqlock);
+
+    last = rq->param.nlevel;
+    for(i = last+1; i <= MLFQ_MAXLEV; i++){
+        for(p = rq->mlfq_s.level[i-1].start; p != 0; p = p->qnext){
+            p->data.mlfq.level = last;
+            p->data.mlfq.exec_count = 0;
+            p->data.mlfq.front = 0;
+        }
+        splice_list(rq, last, i);
     }
 }
 
+// Pick the next process of rq and take it off the queue.
+// Caller holds rq->lock.
 struct proc*
-choice(void){
+choice(struct runq *rq){
 
     struct proc *p = 0;
 
-    int d_exist = 0;
-    int m_exist = 0;
-    int s_exist = 0;
+    mlfq_refresh(rq);
+    // Boost on the clock. ticks only moves on cpu0's timer
+    // interrupt, so the period no longer depends on how
+    // often this queue picks.
+    if(ticks - rq->mlfq_s.boost_tick >= (uint)rq->param.boost)
+        mlfq_boosting(rq);
+
+    int d_exist = rq->nclass[DEFAULT] > 0 ? 1 : 0;
+    int m_exist = rq->nclass[MLFQ] > 0 ? 1 : 0;
+    int s_exist = rq->nclass[SHARE] > 0 ? 1 : 0;
     int order[3];
-    int temp_pass = 0;
+    uint64 temp_pass = 0;
     struct proc *temp = 0;
 
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-            continue;
-        
-        if(p->sched_state == DEFAULT)
-            d_exist = 1;
-        else if(p->sched_state == SHARE){
-            s_exist = 1;
-            if(temp == 0)
-                temp = p;
-            if(temp->data.share.pass > p->data.share.pass)
-                temp = p;
-        }else
-            m_exist = 1;
-    }
-
     if(s_exist != 0){
+        temp = rq->share[0];
         temp_pass = temp->data.share.pass;
-    }else
-        temp_pass = 1;
+    }else{
+        // No SHARE process: order MLFQ against DEFAULT alone.
+        temp_pass = rq->mlfq_s.pass;
+    }
 
-    if (temp_pass > mlfq_s.pass){
-        if(mlfq_s.pass < stride_s.pass){
-            if(stride_s.pass > temp_pass){
+    if (PASS_LT(rq->mlfq_s.pass, temp_pass)){
+        if(PASS_LT(rq->mlfq_s.pass, rq->stride_s.pass)){
+            if(PASS_LT(temp_pass, rq->stride_s.pass)){
                 order[0] = 3*m_exist;
                 order[1] = 2*s_exist;
                 order[2] = 1*d_exist;
@@ -697,8 +1087,8 @@ choice(void){
             order[2] = 2*s_exist;
         }
     } else {
-        if(temp_pass < stride_s.pass){
-            if(mlfq_s.pass < stride_s.pass){
+        if(PASS_LT(temp_pass, rq->stride_s.pass)){
+            if(PASS_LT(rq->mlfq_s.pass, rq->stride_s.pass)){
                 order[0] = 2*s_exist;
                 order[1] = 3*m_exist;
                 order[2] = 1*d_exist;
@@ -719,30 +1109,52 @@ choice(void){
             continue;
         
         if(order[i] == 3){
-            p = mlfq_start();
-            min_pass = mlfq_s.pass;
+            p = mlfq_start(rq);
+            rq->min_pass = rq->mlfq_s.pass;
             break;
         }else if(order[i] == 2){
-            p = temp;
-            p->data.share.strd = 1000/p->data.share.share;
+            p = share_pop(rq);
+            p->slice = 1;
             p->data.share.pass += p->data.share.strd;
-            min_pass = p->data.share.pass;
+            rq->min_pass = p->data.share.pass;
             break;
         }else if(order[i] == 1){
-            p = stride_start();
-            min_pass = stride_s.pass;
+            p = stride_start(rq);
+            rq->min_pass = rq->stride_s.pass;
             break;
         }
     }
 
+    if(p != 0)
+        dequeued_locked(rq, p);
+
     return p;
 }
 
+// Charge the run that p just finished to its statistics.
+// Called by scheduler() with p's lock held.
+static void
+account(struct proc *p)
+{
+  uint n = ticks - p->tick_in;
+
+  // Not since p->stamp: yield() queues p again, and so
+  // restamps it, before it switches back here.
+  p->run_cycles += rdtsc() - p->run_in;
+  p->run_ticks += n;
+  // trap() only preempts a process whose slice is used up.
+  if(p->state == RUNNABLE && p->slice <= 0)
+    p->nivcsw++;
+  else if(p->state != ZOMBIE)
+    p->nvcsw++;
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process from this CPU's run queue,
+//    stealing one from the busiest queue if it is empty
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -751,79 +1163,79 @@ scheduler(void)
 {
   struct proc *p = 0;
   struct cpu *c = mycpu();
+  struct runq *rq = &runq[c - cpus];
+  uint64 pass, now;
   c->proc = 0;
 
   for(;;){
-    struct proc *temp = 0;
     // Enable interrupts on this processor.
     sti();
-    
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
+    //pick the process which is the lowest pass in this cpu's queue
+    acquire(&rq->lock);
+    p = choice(rq);
+    pass = rq->min_pass;
+    release(&rq->lock);
 
-    //pick the process which is the lowest pass and count default process
-    temp = choice();
-    
-    if(temp != 0)
-        p = temp;
-    
-    if(p != 0 && p->state == RUNNABLE){
-        //cprintf("pid:%d mode:%d \n",p->pid,p->sched_state);
-        //if(p->sched_state == SHARE)
-        //    cprintf("%d ",(int)p->data.share.pass);
-        //cprintf("%d %d\n",(int)stride_s.pass,(int)mlfq_s.pass);
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = p;
-        switchuvm(p);
-        p->state = RUNNING;
-        swtch(&(c->scheduler), p->context);
-        switchkvm();
-      // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        if(p->state == UNUSED){
-            if(p->sched_state == MLFQ){
-                pop_list(p,p->data.mlfq.level);
-            }else if(p->sched_state == DEFAULT){
-                pop_list(p,0);
-            }
-        }
-
-        if(mlfq_s.boosting_period == 100)
-            mlfq_boosting();
+    if(p == 0){
+      if(!steal(rq) && !kzerofill())
+        idle(c, rq);
+      continue;
     }
-    release(&ptable.lock);
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    acquire(plock(p));
+    if(p->state != RUNNABLE)
+      panic("scheduler runnable");
+    tracesched(p, pass);
+    now = rdtsc();
+    p->wait_cycles += now - p->stamp;
+    p->run_in = now;
+    p->tick_in = ticks;
+    c->proc = p;
+    switchuvm(p);
+    // cpu 0 keeps time and takes every tick; the other
+    // cpus are interrupted only when the slice runs out.
+    if(c != &cpus[0])
+      lapictimer(p->slice);
+    p->state = RUNNING;
+    swtch(&(c->scheduler), p->context);
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    account(p);
+    release(plock(p));
   }
 }
 
 int cpu_share(int percent){
     struct proc *p = myproc();
-    int share_percent = 0;
+    struct runq *rq = &runq[p->cpu];
 
     acquire(&ptable.lock);
 
-    for(int i = 0; i < NPROC; i++)
-        if(ptable.proc[i].sched_state == SHARE)
-            share_percent += ptable.proc[i].data.share.share;
-
-    if(share_percent + percent > 20 || percent <= 0){
+    if(ptable.share_total + percent > 20 || percent <= 0){
         release(&ptable.lock);
         return 1;
 
     }else{
 
-        if(p->sched_state == DEFAULT){
-            pop_list(p, 0);
-        }else if(p->sched_state == MLFQ){
-            pop_list(p, p->data.mlfq.level);
-        }
+        if(p->sched_state == SHARE)
+            ptable.share_total -= p->data.share.share;
+        ptable.share_total += percent;
 
+        // A running process is on no run queue; its new
+        // class takes effect the next time it is queued.
         p->sched_state = SHARE;
         p->data.share.share = percent;
-        p->data.share.pass = stride_s.pass;
+        p->data.share.strd = STRIDE1/percent;
+        acquire(&rq->lock);
+        p->data.share.pass = rq->stride_s.pass;
+        release(&rq->lock);
         release(&ptable.lock);
         return 0;
     }
@@ -834,6 +1246,7 @@ int cpu_share(int percent){
 
 int run_MLFQ(void){
    struct proc *p = myproc();
+   struct runq *rq = &runq[p->cpu];
 
    acquire(&ptable.lock);
    
@@ -842,22 +1255,20 @@ int run_MLFQ(void){
         return 1;
    }
 
-
-   if(p->sched_state == DEFAULT)
-       pop_list(p,0);
-
+   if(p->sched_state == SHARE)
+       ptable.share_total -= p->data.share.share;
    p->sched_state = MLFQ;
    p->data.mlfq.level = 1;
    p->data.mlfq.exec_count = 0;
+   p->data.mlfq.front = 0;
+   p->data.mlfq.boost = rq->mlfq_s.boost_gen;
 
-   push_list(p,1);
-   
    release(&ptable.lock);
    return 0;
 }
 
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold only the process's lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -870,8 +1281,8 @@ sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(plock(p)))
+    panic("sched proc lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
   if(p->state == RUNNING)
@@ -887,10 +1298,14 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  struct proc *p = myproc();
+
+  acquire(plock(p));  //DOC: yieldlock
+  mlfq_charge(p);
+  p->state = RUNNABLE;
+  rq_enqueue(p);
   sched();
-  release(&ptable.lock);
+  release(plock(p));
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -899,8 +1314,8 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding the process's lock from scheduler.
+  release(plock(myproc()));
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -920,6 +1335,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq;
   
   if(p == 0)
     panic("sleep");
@@ -927,52 +1343,111 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
-  // Go to sleep.
+  // Join chan's wait queue, then acquire the
+  // process's lock in order to change p->state
+  // and call sched. Both happen before lk is
+  // released, and wakeup runs with lk held and
+  // takes p's lock before waking it, so we
+  // can't miss a wakeup. The wait queue lock
+  // is never taken with p's lock held.
+  wq = waitqof(chan);
+  acquire(&wq->lock);
   p->chan = chan;
+  p->wprev = 0;
+  p->wnext = wq->head;
+  if(wq->head)
+    wq->head->wprev = p;
+  wq->head = p;
+  release(&wq->lock);
+
+  acquire(plock(p));  //DOC: sleeplock1
+  mlfq_charge(p);
   p->state = SLEEPING;
+  release(lk);
 
+  // Go to sleep.
   sched();
-
-  // Tidy up.
+  release(plock(p));  //DOC: sleeplock2
+
+  // Tidy up. wakeup and kill leave p on the wait
+  // queue; it is skipped there until it leaves.
+  acquire(&wq->lock);
+  if(p->wprev)
+    p->wprev->wnext = p->wnext;
+  else
+    wq->head = p->wnext;
+  if(p->wnext)
+    p->wnext->wprev = p->wprev;
   p->chan = 0;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  acquire(lk);
 }
 
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// The lock that the sleepers passed to sleep()
+// must be held.
 static void
 wakeup1(void *chan)
 {
+  struct waitq *wq = waitqof(chan);
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
+  acquire(&wq->lock);
+  for(p = wq->head; p != 0; p = p->wnext){
+    if(p->chan != chan)
+      continue;
+    acquire(plock(p));
+    if(p->state == SLEEPING){
       p->state = RUNNABLE;
+      rq_enqueue(p);
+    }
+    release(plock(p));
+  }
+  release(&wq->lock);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-  acquire(&ptable.lock);
   wakeup1(chan);
+}
+
+// Copy the scheduling statistics of process pid into st,
+// including the run or wait it is in the middle of.
+// Returns -1 if there is no such process.
+int
+getschedstat(int pid, struct schedstat *st)
+{
+  struct proc *p;
+  uint64 now;
+
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) != 0){
+    acquire(plock(p));
+    now = rdtsc();
+    st->run_cycles = p->run_cycles;
+    st->wait_cycles = p->wait_cycles;
+    st->run_ticks = p->run_ticks;
+    if(p->state == RUNNING){
+      st->run_cycles += now - p->run_in;
+      st->run_ticks += ticks - p->tick_in;
+    } else if(p->state == RUNNABLE)
+      st->wait_cycles += now - p->stamp;
+    st->nvcsw = p->nvcsw;
+    st->nivcsw = p->nivcsw;
+    memmove(st->level_ticks, p->level_ticks, sizeof(st->level_ticks));
+    if(p->state == RUNNING && p->sched_state == MLFQ)
+      st->level_ticks[p->data.mlfq.level-1] += ticks - p->tick_in;
+    release(plock(p));
+    release(&ptable.lock);
+    return 0;
+  }
   release(&ptable.lock);
+  return -1;
 }
 
 // Kill the process with the given pid.
@@ -984,15 +1459,17 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
+  if((p = findproc(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    acquire(plock(p));
+    if(p->state == SLEEPING){
+      p->state = RUNNABLE;
+      rq_enqueue(p);
     }
+    release(plock(p));
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -1015,6 +1492,7 @@ procdump(void)
   };
   int i;
   struct proc *p;
+  struct cpu *c;
   char *state;
   uint pc[10];
 
@@ -1033,4 +1511,62 @@ procdump(void)
     }
     cprintf("\n");
   }
+  for(c = cpus; c < cpus+ncpu; c++)
+    cprintf("cpu%d idle %d Mcycles\n", (int)(c-cpus), (uint)(c->idle_cycles >> 20));
+}
+
+// Replace the MLFQ tables with *new, returning the ones in
+// force in *old. The swap is atomic; each cpu switches to
+// the new tables at its next scheduling decision. With a
+// null new the tables are only read.
+// May p replace the MLFQ tables? Only init and processes
+// running MLFQCTL may.
+static int
+mlfqctlok(struct proc *p)
+{
+  struct inode *ip;
+  int ok;
+
+  if(p == initproc)
+    return 1;
+  ok = 0;
+  begin_op();
+  if((ip = namei(MLFQCTL)) != 0){
+    ok = ip->dev == ROOTDEV && ip->inum == p->exe;
+    iput(ip);
+  }
+  end_op();
+  return ok;
+}
+
+int
+setmlfq(struct mlfqparam *new, struct mlfqparam *old)
+{
+  int i;
+
+  if(new == 0){
+    acquire(&mlfqlock);
+    *old = mlfq;
+    release(&mlfqlock);
+    return 0;
+  }
+  if(new->nlevel < 1 || new->nlevel > MLFQ_MAXLEV ||
+     new->boost < 1 || new->boost > MLFQ_MAXBOOST)
+    return -1;
+  for(i = 0; i < new->nlevel; i++){
+    if(new->quantum[i] < 1 || new->quantum[i] > MLFQ_MAXQUANTUM)
+      return -1;
+    if(i < new->nlevel-1 &&
+       (new->allot[i] < 1 || new->allot[i] > MLFQ_MAXALLOT))
+      return -1;
+  }
+  if(!mlfqctlok(myproc()))
+    return -1;
+
+  acquire(&mlfqlock);
+  *old = mlfq;
+  mlfq = *new;
+  mlfq_gen++;
+  release(&mlfqlock);
+  return 0;
 }
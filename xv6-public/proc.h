@@ -8,6 +8,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint idle;          // Halted in scheduler() waiting for work
+  uint64 idle_cycles;          // TSC cycles spent halted
 };
 
 extern struct cpu cpus[NCPU];
@@ -39,15 +41,24 @@ enum schedstate { DEFAULT, SHARE, MLFQ };
 struct stride_data {
     int swtch;
 };
+// Stride scheduling runs in fixed point: a process owning
+// the whole cpu has stride STRIDE1. Pass values are 64-bit
+// and compared modulo 2^64, so they may wrap.
+#define STRIDE1         (1 << 20)
+#define PASS_LT(a, b)   ((long long)((a) - (b)) < 0)
+
 struct share_data {
-    double pass;
-    double strd;
+    uint64 pass;
+    uint strd;
     int share;
 };
 
 struct mlfq_data {
     int level;
     int exec_count;
+    int front;      // requeue at the head of its level
+    int given;      // ticks it may run this time, see mlfq_charge()
+    int boost;      // boost generation of its run queue
 };
 
 union sched_data{
@@ -66,6 +77,11 @@ struct proc {
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // Live children
+  struct proc *zombies;        // Children waiting to be reaped
+  struct proc *snext;          // Sibling links in parent's children
+  struct proc *sprev;          //   or zombies list
+  struct proc *hnext;          // Pid hash chain, or free list if UNUSED
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
@@ -73,35 +89,50 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  uint exe;                    // I-number of the program it runs
+  int logres;                  // Log blocks reserved by begin_opn()
+  int bigpages;                // Back the heap with 4MB pages, see lazyfault()
 
   union sched_data data;
   enum schedstate sched_state;  // Scheduling state
+  int cpu;                      // Run queue (cpu index) of this process
+  int slice;                    // Timer ticks left before preemption
+  struct proc *qnext;           // Run queue links
+  struct proc *qprev;
+  struct proc *wnext;           // Wait queue links, see sleep()
+  struct proc *wprev;
+
+  // Scheduling statistics, reported by getschedstat()
+  uint64 stamp;                 // TSC when last queued
+  uint64 run_in;                // TSC when last switched in
+  uint tick_in;                 // ticks when last switched in
+  uint64 run_cycles;
+  uint64 wait_cycles;
+  uint run_ticks;
+  uint nvcsw;
+  uint nivcsw;
+  uint level_ticks[MLFQ_MAXLEV];
 };
 
-struct proc_list{
-    struct proc *p;
-    struct proc_list *next;
-    int use;
-};
-
-struct proc_header{
+// Run queue threaded through the qnext/qprev links of
+// its processes; a process is on at most one queue.
+struct proc_queue{
     int proc_num;
-    struct proc_list *start;
-    struct proc_list *end;
+    struct proc *start;
+    struct proc *end;
 };
 
 struct MLFQ_struct {
-    struct proc_header first;
-    struct proc_header second;
-    struct proc_header third;
-    int boosting_period;
-    double pass;
+    struct proc_queue level[MLFQ_MAXLEV];
+    uint boost_tick;        // ticks at the last boost
+    int boost_gen;
+    uint64 pass;
 };
 
 struct STRIDE_struct {
-    struct proc_header list;
-    double pass;
-    double stride;
+    struct proc_queue list;
+    uint64 pass;
+    uint stride;
     int switch_num;
 };
 
@@ -0,0 +1,72 @@
+// Drain the kernel's scheduler trace and print it.
+//
+// usage: schedlog [-t]
+//
+// Prints one CSV line per switch, or with -t a readable
+// timeline. Each cpu's events come out oldest first.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "trace.h"
+
+#define NBATCH 64
+#define MAXEV  (8*NTRACE)  // stop even if switches keep coming
+
+struct schedevent ev[NBATCH];
+char *classes[] = { "DEFAULT", "SHARE", "MLFQ" };
+
+// printf has no 64-bit conversions.
+void
+printx64(uint64 v)
+{
+  char buf[17];
+  int i;
+
+  for(i = 15; i >= 0; i--){
+    buf[i] = "0123456789abcdef"[v & 0xf];
+    v >>= 4;
+  }
+  buf[16] = 0;
+  printf(1, "%s", buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+  int total = 0;
+  int timeline = 0;
+  struct schedevent *e;
+
+  if(argc > 1 && strcmp(argv[1], "-t") == 0)
+    timeline = 1;
+
+  if(!timeline)
+    printf(1, "tick,tsc,cpu,pid,class,level,pass\n");
+  while(total < MAXEV && (n = schedtrace(ev, NBATCH)) > 0){
+    total += n;
+    for(i = 0; i < n; i++){
+      e = &ev[i];
+      if(timeline){
+        printf(1, "[%d] cpu%d -> pid %d %s", e->tick, e->cpu, e->pid, classes[e->sched_state]);
+        if(e->level >= 0)
+          printf(1, " L%d", e->level);
+        printf(1, "\n");
+      } else {
+        printf(1, "%d,", e->tick);
+        printx64(e->tsc);
+        printf(1, ",%d,%d,%s,%d,", e->cpu, e->pid, classes[e->sched_state], e->level);
+        printx64(e->pass);
+        printf(1, "\n");
+      }
+    }
+    if(n < NBATCH)
+      break;
+  }
+  if(n < 0){
+    printf(2, "schedlog: schedtrace failed\n");
+    exit();
+  }
+  exit();
+}
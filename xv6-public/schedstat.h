@@ -0,0 +1,9 @@
+// Per-process scheduling statistics, see getschedstat().
+struct schedstat {
+  uint64 run_cycles;      // TSC cycles spent running
+  uint64 wait_cycles;     // TSC cycles RUNNABLE but not picked
+  uint run_ticks;         // Clock ticks spent running
+  uint nvcsw;             // Voluntary switches (sleep, yield call)
+  uint nivcsw;            // Involuntary switches (slice ran out)
+  uint level_ticks[MLFQ_MAXLEV]; // Ticks run at each MLFQ level
+};
@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(uvmprefault(curproc->pgdir, curproc->sz, addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,10 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    // Bring in each page before reading from it.
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       uvmprefault(curproc->pgdir, curproc->sz, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -54,7 +60,8 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space, and fault the block
+// in, writable since the kernel may fill it.
 int
 argptr(int n, char **pp, int size)
 {
@@ -65,6 +72,8 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(uvmprefault(curproc->pgdir, curproc->sz, i, size, 1) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -110,6 +119,11 @@ extern int sys_cpu_share(void);
 extern int sys_getlev(void);
 extern int sys_run_MLFQ(void);
 extern int sys_yield(void);
+extern int sys_schedtrace(void);
+extern int sys_getschedstat(void);
+extern int sys_setmlfq(void);
+extern int sys_getlogstat(void);
+extern int sys_bigpages(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -140,6 +154,11 @@ static int (*syscalls[])(void) = {
 [SYS_getlev]   sys_getlev,
 [SYS_run_MLFQ]  sys_run_MLFQ,
 [SYS_yield]     sys_yield,
+[SYS_schedtrace] sys_schedtrace,
+[SYS_getschedstat] sys_getschedstat,
+[SYS_setmlfq] sys_setmlfq,
+[SYS_getlogstat] sys_getlogstat,
+[SYS_bigpages] sys_bigpages,
 };
 
 void
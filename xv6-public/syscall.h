@@ -27,3 +27,8 @@
 #define SYS_getlev 26
 #define SYS_run_MLFQ 27
 #define SYS_yield 28
+#define SYS_schedtrace 29
+#define SYS_getschedstat 30
+#define SYS_setmlfq 31
+#define SYS_getlogstat 32
+#define SYS_bigpages 33
@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "trace.h"
+#include "schedstat.h"
+#include "mlfq.h"
 
 int
 sys_fork(void)
@@ -62,6 +65,21 @@ sys_sbrk(void)
   return addr;
 }
 
+// Turn 4MB heap pages on or off for the calling process
+// and its future children. exec() turns them off. Returns
+// the old setting.
+int
+sys_bigpages(void)
+{
+  int on, old;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  old = myproc()->bigpages;
+  myproc()->bigpages = (on != 0);
+  return old;
+}
+
 int
 sys_sleep(void)
 {
@@ -117,3 +135,49 @@ int sys_yield(void){
     yield();
     return 1;
 }
+
+int sys_schedtrace(void){
+    struct schedevent *buf;
+    int n;
+
+    if(argint(1, &n) < 0 || n < 0)
+        return -1;
+    // No more can be buffered, and n*sizeof(*buf)
+    // must not overflow.
+    if(n > NCPU*NTRACE)
+        n = NCPU*NTRACE;
+    if(argptr(0, (char**)&buf, n*sizeof(*buf)) < 0)
+        return -1;
+    return traceread(buf, n);
+}
+
+int sys_getschedstat(void){
+    struct schedstat *st;
+    int pid;
+
+    if(argint(0, &pid) < 0)
+        return -1;
+    if(argptr(1, (char**)&st, sizeof(*st)) < 0)
+        return -1;
+    return getschedstat(pid, st);
+}
+
+int sys_setmlfq(void){
+    struct mlfqparam *new, *old;
+    struct mlfqparam knew, kold;
+    int addr;
+
+    // A null new only reads the tables.
+    if(argint(0, &addr) < 0)
+        return -1;
+    if(addr != 0 && argptr(0, (char**)&new, sizeof(*new)) < 0)
+        return -1;
+    if(argptr(1, (char**)&old, sizeof(*old)) < 0)
+        return -1;
+    if(addr != 0)
+        knew = *new;
+    if(setmlfq(addr != 0 ? &knew : 0, &kold) < 0)
+        return -1;
+    *old = kold;
+    return 0;
+}
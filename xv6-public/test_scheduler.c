@@ -6,6 +6,8 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "param.h"
+#include "schedstat.h"
 
 #define LIFETIME		(1000)	/* (ticks) */
 #define COUNT_PERIOD	(1000000)	/* (iteration) */
@@ -16,6 +18,31 @@
 
 
 
+/**
+ * This function reports the CPU time the kernel actually gave this process
+ * since start_tick, measured against the ticks that passed meanwhile.
+ */
+void
+report_share(struct schedstat *start, int start_tick)
+{
+	struct schedstat end;
+	int ran;
+	int elapsed;
+
+	if (getschedstat(getpid(), &end) != 0) {
+		printf(1, "FAIL : getschedstat\n");
+		return;
+	}
+	ran = end.run_ticks - start->run_ticks;
+	elapsed = uptime() - start_tick;
+	if (elapsed <= 0)
+		elapsed = 1;
+
+	printf(1, "  pid %d achieved : %d/%d ticks (%d%%), switch : %d voluntary, %d involuntary\n",
+			getpid(), ran, elapsed, ran * 100 / elapsed,
+			end.nvcsw - start->nvcsw, end.nivcsw - start->nivcsw);
+}
+
 /**
  * This function report the cnt value which have been accumulated during LIFETIME.
  */
@@ -26,9 +53,11 @@ test_default(int dummy)
 	int i = 0;
 	int start_tick;
 	int curr_tick;
+	struct schedstat start_stat;
 
 	/* Get start tick */
 	start_tick = uptime();
+	getschedstat(getpid(), &start_stat);
 
 	for (;;) {
 		i++;
@@ -48,6 +77,7 @@ test_default(int dummy)
 
 	/* Report */
 	printf(1, "DEFAULT, cnt : %d\n", cnt);
+	report_share(&start_stat, start_tick);
 
 	return;
 
@@ -65,6 +95,7 @@ test_stride(int portion)
 	int i = 0;
 	int start_tick;
 	int curr_tick;
+	struct schedstat start_stat;
 
 	if (cpu_share(portion) != 0) {
 		printf(1, "FAIL : cpu_share\n");
@@ -73,6 +104,7 @@ test_stride(int portion)
 
 	/* Get start tick */
 	start_tick = uptime();
+	getschedstat(getpid(), &start_stat);
 
 	for (;;) {
 		i++;
@@ -92,6 +124,7 @@ test_stride(int portion)
 
 	/* Report */
 	printf(1, "STRIDE(%d%%), cnt : %d\n", portion, cnt);
+	report_share(&start_stat, start_tick);
 
 	return;
 }
@@ -113,6 +146,7 @@ test_mlfq(int type)
 	int curr_mlfq_level;
 	int start_tick;
 	int curr_tick;
+	struct schedstat start_stat;
 
 	if (run_MLFQ() != 0) {
 		printf(1, "FAIL : run_MLFQ\n");
@@ -121,6 +155,7 @@ test_mlfq(int type)
 
 	/* Get start tick */
 	start_tick = uptime();
+	getschedstat(getpid(), &start_stat);
 
 	for (;;) {
 		i++;
@@ -131,7 +166,9 @@ test_mlfq(int type)
 			if (type == MLFQ_LEVCNT || type == MLFQ_LEVCNT_YIELD ) {
 				/* Count per level */
 				curr_mlfq_level = getlev(); /* getlev : system call */
-				cnt_level[curr_mlfq_level]++;
+				/* Levels past the third only exist after setmlfq() */
+				if (curr_mlfq_level >= 0 && curr_mlfq_level < MLFQ_LEVEL)
+					cnt_level[curr_mlfq_level]++;
 			}
 
 			/* Get current tick */
@@ -157,6 +194,7 @@ test_mlfq(int type)
 		printf(1, "MLfQ(%s), cnt : %d\n",
 				type == MLFQ_NONE ? "compute" : "yield", cnt);
 	}
+	report_share(&start_stat, start_tick);
 
 	return;
 }
@@ -0,0 +1,77 @@
+// TLB reach benchmark for bigpages().
+//
+// usage: tlbbench [mb [rounds]]
+//
+// Grows the heap by mb megabytes, 4MB-aligned, touches it
+// all, then reads one word from every page, rounds times,
+// stepping through the pages in a scattered order so that
+// nearly every read needs a translation the TLB does not
+// hold. Runs once with 4KB pages and once with 4MB pages
+// and prints the ticks each run took.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define BIG (4*1024*1024)
+#define PG 4096
+#define STEP 1021              // prime, so every page is visited
+
+int sink;                      // keeps the reads from being dropped
+
+int
+run(int big, int mb, int rounds)
+{
+  char *p;
+  uint pad, npg, i, j, k;
+  int start, sum;
+
+  bigpages(big);
+  p = sbrk(0);
+  pad = (BIG - (uint)p % BIG) % BIG;
+  if(sbrk(pad + mb*1024*1024) == (char*)-1){
+    printf(2, "tlbbench: sbrk failed\n");
+    exit();
+  }
+  p += pad;
+  npg = mb*1024*1024 / PG;
+  for(i = 0; i < npg; i++)
+    p[i*PG] = i;
+
+  sum = 0;
+  start = uptime();
+  for(j = 0; j < rounds; j++){
+    k = 0;
+    for(i = 0; i < npg; i++){
+      sum += p[k*PG + (i % 64) * 64];
+      k = (k + STEP) % npg;
+    }
+  }
+  start = uptime() - start;
+  sbrk(-(pad + mb*1024*1024));
+  bigpages(0);
+  sink = sum;
+  return start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 32, rounds = 200;
+  int small, big;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(mb <= 0 || mb % 4){
+    printf(2, "tlbbench: mb must be a positive multiple of 4\n");
+    exit();
+  }
+
+  small = run(0, mb, rounds);
+  big = run(1, mb, rounds);
+  printf(1, "tlbbench: %d MB x %d rounds: 4KB pages %d ticks, "
+         "4MB pages %d ticks\n", mb, rounds, small, big);
+  exit();
+}
@@ -0,0 +1,80 @@
+// Per-cpu scheduler trace.
+//
+// scheduler() appends one event per switch to its own cpu's
+// ring without taking a lock: the cpu is the only producer
+// of its ring, so it only has to publish head after the
+// event is written. Readers drain through the schedtrace
+// system call and are serialized by tracelock. When a ring
+// is full, new events are dropped until it is drained.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "trace.h"
+
+struct {
+  struct schedevent ev[NTRACE];
+  volatile uint head;          // Next slot written by the cpu
+  volatile uint tail;          // Next slot read by a reader
+} tracebuf[NCPU];
+
+struct spinlock tracelock;
+
+void
+traceinit(void)
+{
+  initlock(&tracelock, "trace");
+}
+
+// Record a switch to p with the given class pass.
+// Called by scheduler() with interrupts disabled.
+void
+tracesched(struct proc *p, uint64 pass)
+{
+  int id = cpuid();
+  uint head = tracebuf[id].head;
+  struct schedevent *e;
+
+  if(head - tracebuf[id].tail == NTRACE)
+    return;
+
+  e = &tracebuf[id].ev[head % NTRACE];
+  e->tsc = rdtsc();
+  e->pass = pass;
+  e->tick = ticks;
+  e->cpu = id;
+  e->pid = p->pid;
+  e->sched_state = p->sched_state;
+  e->level = p->sched_state == MLFQ ? p->data.mlfq.level-1 : -1;
+
+  // Make the event visible before the slot is published.
+  __sync_synchronize();
+  tracebuf[id].head = head + 1;
+}
+
+// Move up to n buffered events, oldest first per cpu, into dst.
+// Returns the number of events copied.
+int
+traceread(struct schedevent *dst, int n)
+{
+  int i, copied = 0;
+  uint head, tail;
+
+  acquire(&tracelock);
+  for(i = 0; i < ncpu && copied < n; i++){
+    head = tracebuf[i].head;
+    __sync_synchronize();
+    for(tail = tracebuf[i].tail; tail != head && copied < n; tail++)
+      dst[copied++] = tracebuf[i].ev[tail % NTRACE];
+    // Done reading the slots before handing them back.
+    __sync_synchronize();
+    tracebuf[i].tail = tail;
+  }
+  release(&tracelock);
+  return copied;
+}
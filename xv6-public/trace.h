@@ -0,0 +1,12 @@
+// Scheduler trace event: one per switch to a process.
+struct schedevent {
+  uint64 tsc;        // Time stamp counter at the switch
+  uint64 pass;       // Pass of the process's class after the pick
+  uint tick;         // Clock tick at the switch
+  int cpu;           // Cpu that switched
+  int pid;           // Process switched to
+  int sched_state;   // DEFAULT, SHARE or MLFQ
+  int level;         // MLFQ level (getlev() numbering) or -1
+};
+
+#define NTRACE 256   // events buffered per cpu
@@ -48,12 +48,25 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    // The timer is one-shot. cpu 0 keeps time, so it re-arms
+    // for every tick; another cpu was armed by scheduler() for
+    // exactly the running process's slice.
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
-    }
+      lapictimer(1);
+      if(myproc())
+        myproc()->slice--;
+    } else if(myproc())
+      myproc()->slice = 0;
+    else
+      lapictimer(1);
+    lapiceoi();
+    break;
+  case T_RESCHED:
+    // Only wakes an idle cpu out of hlt in scheduler().
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -78,6 +91,21 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A write to a copy-on-write page or the first touch of
+    // a lazily grown heap page, from user space. System calls
+    // fault user memory in with uvmprefault() before the
+    // kernel uses it, so a failure here in the kernel is a
+    // bug.
+    if(myproc() != 0){
+      if(tf->err & FEC_PR){
+        if((tf->err & FEC_WR) && cowfault(myproc()->pgdir, rcr2()) == 0)
+          break;
+      } else if(lazyfault(myproc()->pgdir, myproc()->sz, rcr2()) == 0)
+        break;
+    }
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -101,10 +129,10 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU when its slice is used up.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER && myproc()->slice <= 0)
     yield();
 
   // Check if the process has been killed since we yielded
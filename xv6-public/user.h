@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct schedevent;
+struct schedstat;
+struct mlfqparam;
+struct logstat;
 
 // system calls
 int fork(void);
@@ -30,6 +34,11 @@ int cpu_share(int);
 int getlev(void);
 int run_MLFQ(void);
 void yield(void);
+int schedtrace(struct schedevent*, int);
+int getschedstat(int, struct schedstat*);
+int setmlfq(struct mlfqparam*, struct mlfqparam*);
+int getlogstat(struct logstat*);
+int bigpages(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
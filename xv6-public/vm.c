@@ -10,6 +10,11 @@
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// A 4MB user page is one block from kallocpages(MAXORDER).
+#if (PGSIZE << MAXORDER) != PDSIZE
+#error "MAXORDER does not give 4MB blocks"
+#endif
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -31,7 +36,8 @@ seginit(void)
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. If va is in a
+// 4MB page, return its page directory entry instead.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +45,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -101,7 +108,9 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // (directly addressable from end..P2V(PHYSTOP)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table. kvmalloc() builds them once in
+// kpgdir, with 4MB pages wherever it can, and every other page
+// table shares kpgdir's kernel entries.
 static struct kmap {
   void *virt;
   uint phys_start;
@@ -114,24 +123,43 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Map size bytes at va to pa like mappages(), but use a
+// 4MB page for every 4MB-aligned stretch. All entries are
+// global; only kernel mappings may be made this way.
+static int
+kmappages(pde_t *pgdir, char *va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if((uint)va % PDSIZE == 0 && pa % PDSIZE == 0 && size >= PDSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      n = PDSIZE;
+    } else {
+      if(mappages(pgdir, va, PGSIZE, pa, perm | PTE_G) < 0)
+        return -1;
+      n = PGSIZE;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table by sharing kpgdir's
+// page directory entries.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
@@ -140,7 +168,16 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kzalloc()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kmappages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -186,8 +223,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -231,13 +267,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,6 +283,27 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Replace the 4MB user page at pde with a page table that
+// maps the same memory with 4KB pages, so that the pages can
+// be shared, protected and freed one by one. Returns -1 if
+// out of memory. The caller flushes the TLB.
+static int
+bigsplit(pde_t *pde)
+{
+  pte_t *pgtab;
+  uint pa, flags, i;
+
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pa = PTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  ksplitpages(P2V(pa), MAXORDER);
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i*PGSIZE) | flags;
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -255,6 +311,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
 
@@ -263,6 +320,21 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if(*pde & PTE_PS){
+      if(a % PDSIZE == 0){
+        kfreepages(P2V(PTE_ADDR(*pde)), MAXORDER);
+        *pde = 0;
+        a += PDSIZE - PGSIZE;
+        continue;
+      }
+      // Only part of the 4MB page goes. If there is no
+      // memory to split it, leave it all mapped for now.
+      if(bigsplit(pde) < 0){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -288,7 +360,8 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  // The kernel's entries belong to kpgdir.
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -311,39 +384,167 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The pages are not copied: both
+// tables map them read-only and marked PTE_COW, and
+// cowfault() copies a page on the first write to it.
+// 4MB pages are split into 4KB ones first, so that a
+// write copies only 4KB. pgdir must be the current page
+// table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    if((pgdir[PDX(i)] & PTE_PS) && bigsplit(&pgdir[PDX(i)]) < 0)
+      goto bad;
+    // Heap pages never touched are not mapped yet.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
+    kref(P2V(pa));
   }
+  // The parent may have cached writable translations.
+  lcr3(V2P(pgdir));
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Map a zeroed 4MB page over the 4MB of pgdir around va,
+// if all of it is below sz and none of it is mapped yet.
+// Returns -1 if not, or if no 4MB block is free.
+static int
+bigfault(pde_t *pgdir, uint sz, uint va)
+{
+  uint a;
+  char *mem;
+
+  a = va & ~(PDSIZE - 1);
+  if(a + PDSIZE > sz || (pgdir[PDX(a)] & PTE_P))
+    return -1;
+  if((mem = kallocpages(MAXORDER)) == 0)
+    return -1;
+  memset(mem, 0, PDSIZE);
+  pgdir[PDX(a)] = V2P(mem) | PTE_PS | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
+// Handle a fault on the unmapped page at va in pgdir, the
+// current page table of a process of size sz. sbrk() grows
+// the heap without allocating, so map a zeroed page if va
+// is below sz. A process that asked for bigpages() gets a
+// whole 4MB page where one fits, so that a large heap takes
+// few TLB entries. Returns -1 for a bad address or if memory
+// is short.
+int
+lazyfault(pde_t *pgdir, uint sz, uint va)
+{
+  char *mem;
+
+  if(va >= sz || va >= KERNBASE)
+    return -1;
+  if(myproc()->bigpages && bigfault(pgdir, sz, va) == 0)
+    return 0;
+  if((mem = kzalloc()) == 0)
+    return -1;
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Give the copy-on-write page at pte to its table alone.
+// Returns the kernel address of the page, or 0 if out of
+// memory. The caller flushes the TLB.
+static char*
+cowbreak(pte_t *pte)
+{
+  uint pa;
+  char *mem;
+
+  pa = PTE_ADDR(*pte);
+  if(krefcount(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return 0;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | PTE_FLAGS(*pte);
+    kfree(P2V(pa));
+  }
+  *pte = (*pte & ~PTE_COW) | PTE_W;
+  return P2V(PTE_ADDR(*pte));
+}
+
+// Handle a write fault at va in pgdir, the current page
+// table. If the page is copy-on-write, give this table its
+// own writable copy, or just make it writable if no other
+// table shares it any more. Returns -1 if the fault is not
+// a copy-on-write one or memory is short.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  if(cowbreak(pte) == 0)
+    return -1;
+  lcr3(V2P(pgdir));
+  return 0;
+}
+
+// Make the pages of the current page table pgdir that cover
+// [va, va+len) present, and writable if write is set, as a
+// user access would through lazyfault() and cowfault().
+// System calls do this before the kernel touches user
+// memory, so that running out of memory fails the call
+// rather than faulting in the kernel. Returns -1 if the
+// range is outside sz or some page cannot be had.
+int
+uvmprefault(pde_t *pgdir, uint sz, uint va, uint len, int write)
+{
+  uint a, last;
+  pte_t *pte;
+
+  if(len == 0)
+    return 0;
+  if(va >= sz || va + len > sz || va + len < va)
+    return -1;
+  last = PGROUNDDOWN(va + len - 1);
+  for(a = PGROUNDDOWN(va); ; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0){
+      if(lazyfault(pgdir, sz, a) < 0)
+        return -1;
+    } else if(write && (*pte & PTE_COW)){
+      if(cowfault(pgdir, a) < 0)
+        return -1;
+    }
+    if(a == last)
+      break;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,10 +553,12 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte) + PGROUNDDOWN((uint)uva % PDSIZE));
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
@@ -367,6 +570,7 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
@@ -374,6 +578,9 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if((*pte & PTE_COW) && (pa0 = cowbreak(pte)) == 0)
+      return -1;
     n = PGSIZE - (va - va0);
     if(n > len)
       n = len;
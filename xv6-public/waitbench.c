@@ -0,0 +1,71 @@
+// fork/wait microbenchmark.
+//
+// usage: waitbench [idle [rounds]]
+//
+// Parks idle children blocked on a pipe so that the process
+// table is busy, then times rounds of forking a batch of
+// children and reaping them all. Reaping should cost the
+// same however many other processes exist.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define BATCH 8
+
+int
+main(int argc, char *argv[])
+{
+  int idle = 40, rounds = 500;
+  int fd[2];
+  int i, j, pid, start, end;
+  char c;
+
+  if(argc > 1)
+    idle = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+
+  if(pipe(fd) < 0){
+    printf(2, "waitbench: pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < idle; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "waitbench: only %d idle children\n", i);
+      idle = i;
+      break;
+    }
+    if(pid == 0){
+      close(fd[1]);
+      read(fd[0], &c, 1);
+      exit();
+    }
+  }
+  close(fd[0]);
+
+  start = uptime();
+  for(i = 0; i < rounds; i++){
+    for(j = 0; j < BATCH; j++){
+      pid = fork();
+      if(pid < 0){
+        printf(2, "waitbench: fork failed\n");
+        break;
+      }
+      if(pid == 0)
+        exit();
+    }
+    for(; j > 0; j--)
+      wait();
+  }
+  end = uptime();
+  printf(1, "waitbench: %d idle, %d forks reaped in %d ticks\n",
+         idle, rounds*BATCH, end-start);
+
+  // Closing the pipe releases the idle children.
+  close(fd[1]);
+  for(i = 0; i < idle; i++)
+    wait();
+  exit();
+}